@@ -0,0 +1,116 @@
+/************************************************
+*				MESA timer benchmark
+* Expiry cost: MESA_timer_check invoking a callback per
+* event against MESA_timer_check_collect handing events
+* out to a tight loop. Events are scattered in memory.
+************************************************/
+#include<stdio.h>
+#include<stdlib.h>
+#include<time.h>
+#include"MESA_timer.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include<x86intrin.h>
+#define CYCLES() __rdtsc()
+#else
+#define CYCLES() 0
+#endif
+
+#define COLLECT_BATCH 256
+
+typedef struct event_t{
+    long id;
+    long hits;
+    char pad[48];
+}event_t;
+
+static void event_cb(void *event)
+{
+    ((event_t *)event)->hits ++;
+}
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* add n events in a random memory order with timeouts spread over wheel_size ticks */
+static MESA_timer_t *fill_timer(int type, long wheel_size, event_t *events, long *order, long n)
+{
+    MESA_timer_t *timer = MESA_timer_create(wheel_size, type);
+    MESA_timer_index_t *index;
+    long i;
+
+    for(i = 0; i < n; i++)
+    {
+        MESA_timer_add(timer, 0, rand() % 1000, event_cb, &events[order[i]], NULL, &index);
+    }
+    return timer;
+}
+
+static void bench_collect(const char *name, int type, long wheel_size, event_t *events, long *order, long n)
+{
+    MESA_timer_expired_t expired[COLLECT_BATCH];
+    MESA_timer_t *timer;
+    unsigned long long c0, c1;
+    double t0, t1;
+    long fired, cnt, i;
+
+    timer = fill_timer(type, wheel_size, events, order, n);
+    t0 = now_ns();
+    c0 = CYCLES();
+    fired = MESA_timer_check(timer, 1000, n);
+    c1 = CYCLES();
+    t1 = now_ns();
+    printf("%-8s callback: %8ld expiries %7.1f cycles %6.1f ns per expiry\n",
+            name, fired, (double)(c1 - c0) / fired, (t1 - t0) / fired);
+    MESA_timer_destroy(timer);
+
+    timer = fill_timer(type, wheel_size, events, order, n);
+    fired = 0;
+    t0 = now_ns();
+    c0 = CYCLES();
+    while((cnt = MESA_timer_check_collect(timer, 1000, expired, COLLECT_BATCH)) > 0)
+    {
+        for(i = 0; i < cnt; i++)
+        {
+            ((event_t *)expired[i].event)->hits ++;
+        }
+        fired += cnt;
+    }
+    c1 = CYCLES();
+    t1 = now_ns();
+    printf("%-8s collect:  %8ld expiries %7.1f cycles %6.1f ns per expiry\n",
+            name, fired, (double)(c1 - c0) / fired, (t1 - t0) / fired);
+    MESA_timer_destroy(timer);
+}
+
+int main(int argc, char *argv[])
+{
+    long n = argc > 1 ? atol(argv[1]) : 1000000;
+    event_t *events = (event_t *)calloc(n, sizeof(event_t));
+    long *order = (long *)malloc(sizeof(long) * n);
+    long i;
+
+    srand(1);
+    for(i = 0; i < n; i++)
+    {
+        order[i] = i;
+    }
+    for(i = n - 1; i > 0; i--)
+    {
+        long j = rand() % (i + 1), tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+
+    bench_collect("wheel", TM_TYPE_WHEEL, 1000, events, order, n);
+    bench_collect("hwheel", TM_TYPE_HWHEEL, 0, events, order, n);
+    bench_collect("heap", TM_TYPE_HEAP, 0, events, order, n);
+
+    free(order);
+    free(events);
+    return 0;
+}
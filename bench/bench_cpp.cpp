@@ -0,0 +1,131 @@
+/************************************************
+*				MESA timer benchmark
+* TM_TYPE_WHEEL through the C API against the
+* header only mesa::TimerWheel, with a power of 2
+* wheel size and without. Sessions are added,
+* reset by packets and time out, in virtual ms.
+************************************************/
+#include<stdio.h>
+#include<stdlib.h>
+#include<time.h>
+#include"MESA_timer.h"
+#include"MESA_timer.hpp"
+
+#define SESSIONS 1000000
+#define PACKETS 20000000
+#define IDLE_TIMEOUT 3000
+
+static long fired;
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void event_cb(void *event)
+{
+    fired ++;
+}
+
+struct Session
+{
+    long id;
+};
+
+struct SessionTimeout
+{
+    void operator()(Session &)
+    {
+        fired ++;
+    }
+};
+
+static void report(const char *name, double t0, double t1)
+{
+    printf("%-22s %6.1f ns per packet, %ld timed out\n", name, (t1 - t0) / PACKETS, fired);
+}
+
+static void bench_c(long wheel_size)
+{
+    MESA_timer_handle_t *handles = (MESA_timer_handle_t *)calloc(SESSIONS, sizeof(MESA_timer_handle_t));
+    MESA_timer_opt_t opt;
+    MESA_timer_t *timer;
+    long i, now = 0;
+    double t0;
+    char name[32];
+
+    MESA_timer_opt_init(&opt);
+    opt.type = TM_TYPE_WHEEL;
+    opt.wheel_size = wheel_size;
+    opt.prealloc_elems = SESSIONS;
+    timer = MESA_timer_create_ex(&opt);
+
+    srand(1);
+    fired = 0;
+    t0 = now_ns();
+    for(i = 0; i < PACKETS; i++)
+    {
+        /* a millisecond passes every 1000 packets */
+        if(i % 1000 == 0)
+        {
+            now ++;
+            MESA_timer_check(timer, now, SESSIONS);
+        }
+        long s = rand() % SESSIONS;
+        if(MESA_timer_reset_h(timer, handles[s], now, IDLE_TIMEOUT) != 0)
+        {
+            /* new session, or its handle went stale when it timed out */
+            MESA_timer_add_h(timer, now, IDLE_TIMEOUT, event_cb, NULL, NULL, &handles[s]);
+        }
+    }
+    snprintf(name, sizeof(name), "C wheel %ld", wheel_size);
+    report(name, t0, now_ns());
+
+    MESA_timer_destroy(timer);
+    free(handles);
+}
+
+template<long WheelSize>
+static void bench_cpp()
+{
+    typedef mesa::TimerWheel<Session, SessionTimeout, WheelSize> wheel_t;
+    wheel_t *wheel = new wheel_t();
+    typename wheel_t::Handle *handles = new typename wheel_t::Handle[SESSIONS];
+    long i, now = 0;
+    double t0;
+    char name[32];
+
+    srand(1);
+    fired = 0;
+    t0 = now_ns();
+    for(i = 0; i < PACKETS; i++)
+    {
+        if(i % 1000 == 0)
+        {
+            now ++;
+            wheel->check(now, SESSIONS);
+        }
+        long s = rand() % SESSIONS;
+        if(!handles[s].reset(now, IDLE_TIMEOUT))
+        {
+            Session session = {s};
+            handles[s] = wheel->add(now, IDLE_TIMEOUT, session);
+        }
+    }
+    snprintf(name, sizeof(name), "C++ TimerWheel %ld", WheelSize);
+    report(name, t0, now_ns());
+
+    delete[] handles;
+    delete wheel;
+}
+
+int main()
+{
+    bench_c(1000);
+    bench_c(1024);
+    bench_cpp<1000>();
+    bench_cpp<1024>();
+    return 0;
+}
@@ -0,0 +1,75 @@
+/************************************************
+*				MESA timer benchmark
+* A burst of slow callbacks due at one tick: how long
+* the checking thread is busy when it runs them
+* inline, and when an executor runs them.
+* Usage: bench_executor [threads] [events] [callback ns]
+************************************************/
+#include<stdio.h>
+#include<stdlib.h>
+#include<time.h>
+#include"MESA_timer_executor.h"
+
+static long callback_ns;
+static long fired;
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* e.g. flushing a session record to a logger */
+static void event_cb(void *event)
+{
+    double end = now_ns() + callback_ns;
+    while(now_ns() < end)
+        ;
+    __atomic_add_fetch(&fired, 1, __ATOMIC_RELAXED);
+}
+
+static MESA_timer_t *burst(long events)
+{
+    MESA_timer_t *timer = MESA_timer_create(1024, TM_TYPE_WHEEL);
+    MESA_timer_handle_t handle;
+    long i;
+
+    for(i = 0; i < events; i++)
+    {
+        MESA_timer_add_h(timer, 0, 10, event_cb, NULL, NULL, &handle);
+    }
+    return timer;
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    long events = argc > 2 ? atol(argv[2]) : 20000;
+    MESA_timer_executor_t *executor;
+    MESA_timer_t *timer;
+    double t0, t1, t2;
+
+    callback_ns = argc > 3 ? atol(argv[3]) : 20000;
+
+    timer = burst(events);
+    fired = 0;
+    t0 = now_ns();
+    MESA_timer_check(timer, 20, events);
+    t1 = now_ns();
+    printf("inline:   check %10.1f us, %ld callbacks done %10.1f us\n", (t1 - t0) / 1000, fired, (t1 - t0) / 1000);
+    MESA_timer_destroy(timer);
+
+    executor = MESA_timer_executor_create(threads, events);
+    timer = burst(events);
+    fired = 0;
+    t0 = now_ns();
+    MESA_timer_executor_check(executor, timer, 20, events);
+    t1 = now_ns();
+    MESA_timer_executor_wait(executor);
+    t2 = now_ns();
+    printf("executor: check %10.1f us, %ld callbacks done %10.1f us, %d threads\n", (t1 - t0) / 1000, fired, (t2 - t0) / 1000, threads);
+    MESA_timer_destroy(timer);
+    MESA_timer_executor_destroy(executor);
+    return 0;
+}
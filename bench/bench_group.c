@@ -0,0 +1,112 @@
+/************************************************
+*				MESA timer benchmark
+* Timer group with a skewed load: shard 0 owns every
+* event, the other workers only steal its expiries.
+* Usage: bench_group [workers] [events] [callback ns]
+************************************************/
+#include<stdio.h>
+#include<stdlib.h>
+#include<time.h>
+#include<pthread.h>
+#include"MESA_timer_group.h"
+
+typedef struct worker_t{
+    MESA_timer_group_t *group;
+    int shard;
+    long fired;
+}worker_t;
+
+static long total_events;
+static long callback_ns;
+static long fired_all;
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* a callback doing some work of its own */
+static void event_cb(void *event)
+{
+    double end = now_ns() + callback_ns;
+    while(now_ns() < end)
+        ;
+    (*(long *)event) ++;
+    __atomic_add_fetch(&fired_all, 1, __ATOMIC_RELAXED);
+}
+
+static void *worker_run(void *arg)
+{
+    worker_t *worker = (worker_t *)arg;
+    long cnt;
+
+    while(__atomic_load_n(&fired_all, __ATOMIC_RELAXED) < total_events)
+    {
+        cnt = MESA_timer_group_check(worker->group, worker->shard, 1000, 1L << 30);
+        worker->fired += cnt;
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    int workers = argc > 1 ? atoi(argv[1]) : 4;
+    MESA_timer_opt_t opt;
+    MESA_timer_group_t *group;
+    MESA_timer_index_t *index;
+    pthread_t *threads;
+    worker_t *args;
+    long *hits, i;
+    double t0, t1;
+
+    total_events = argc > 2 ? atol(argv[2]) : 200000;
+    callback_ns = argc > 3 ? atol(argv[3]) : 1000;
+
+    MESA_timer_opt_init(&opt);
+    opt.type = TM_TYPE_WHEEL;
+    opt.wheel_size = 1000;
+    group = MESA_timer_group_create(workers, &opt);
+    hits = (long *)calloc(total_events, sizeof(long));
+    for(i = 0; i < total_events; i++)
+    {
+        MESA_timer_add(MESA_timer_group_shard(group, 0), 0, i % 500, event_cb, &hits[i], NULL, &index);
+    }
+
+    threads = (pthread_t *)malloc(sizeof(pthread_t) * workers);
+    args = (worker_t *)calloc(workers, sizeof(worker_t));
+    t0 = now_ns();
+    for(i = 0; i < workers; i++)
+    {
+        args[i].group = group;
+        args[i].shard = i;
+        pthread_create(&threads[i], NULL, worker_run, &args[i]);
+    }
+    for(i = 0; i < workers; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    t1 = now_ns();
+
+    for(i = 0; i < total_events; i++)
+    {
+        if(hits[i] != 1)
+        {
+            printf("event %ld fired %ld times\n", i, hits[i]);
+            return 1;
+        }
+    }
+    printf("%d workers: %ld expiries in %.1f ms, %.0f expiries/s\n",
+            workers, total_events, (t1 - t0) / 1e6, total_events / ((t1 - t0) / 1e9));
+    for(i = 0; i < workers; i++)
+    {
+        printf("  worker %ld: %ld callbacks\n", i, args[i].fired);
+    }
+
+    MESA_timer_group_destroy(group);
+    free(args);
+    free(threads);
+    free(hits);
+    return 0;
+}
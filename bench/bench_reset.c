@@ -0,0 +1,72 @@
+/************************************************
+*				MESA timer benchmark
+* Per-packet session refresh: every packet resets
+* its session's idle timeout, with and without
+* lazy_reset. Time is virtual, in ms.
+************************************************/
+#include<stdio.h>
+#include<stdlib.h>
+#include<time.h>
+#include"MESA_timer.h"
+
+#define SESSIONS 1000000
+#define PACKETS 20000000
+#define IDLE_TIMEOUT 30000
+
+static void event_cb(void *event)
+{
+}
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench_reset(const char *name, int type, long wheel_size, int lazy)
+{
+    MESA_timer_index_t **indexes = (MESA_timer_index_t **)malloc(sizeof(MESA_timer_index_t *) * SESSIONS);
+    MESA_timer_opt_t opt;
+    MESA_timer_t *timer;
+    long i, now = 0;
+    double t0, t1;
+
+    MESA_timer_opt_init(&opt);
+    opt.type = type;
+    opt.wheel_size = wheel_size;
+    opt.lazy_reset = lazy;
+    opt.prealloc_elems = SESSIONS;
+    timer = MESA_timer_create_ex(&opt);
+    for(i = 0; i < SESSIONS; i++)
+    {
+        MESA_timer_add(timer, 0, IDLE_TIMEOUT, event_cb, NULL, NULL, &indexes[i]);
+    }
+
+    srand(1);
+    t0 = now_ns();
+    for(i = 0; i < PACKETS; i++)
+    {
+        /* a millisecond passes every 1000 packets */
+        if(i % 1000 == 0)
+        {
+            now ++;
+            MESA_timer_check(timer, now, SESSIONS);
+        }
+        MESA_timer_reset(timer, indexes[rand() % SESSIONS], now, IDLE_TIMEOUT);
+    }
+    t1 = now_ns();
+    printf("%-8s lazy_reset %d: %6.1f ns per packet\n", name, lazy, (t1 - t0) / PACKETS);
+
+    MESA_timer_destroy(timer);
+    free(indexes);
+}
+
+int main()
+{
+    bench_reset("wheel", TM_TYPE_WHEEL, 10000, 0);
+    bench_reset("wheel", TM_TYPE_WHEEL, 10000, 1);
+    bench_reset("hwheel", TM_TYPE_HWHEEL, 0, 0);
+    bench_reset("hwheel", TM_TYPE_HWHEEL, 0, 1);
+    return 0;
+}
@@ -0,0 +1,66 @@
+/************************************************
+*				MESA timer benchmark
+* Stall recovery: how long the first MESA_timer_check
+* takes after the caller did not check for a while.
+* Time is virtual, in microseconds.
+************************************************/
+#include<stdio.h>
+#include<stdlib.h>
+#include<time.h>
+#include"MESA_timer.h"
+
+static long fired;
+
+static void event_cb(void *event)
+{
+    fired ++;
+}
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench_stall(const char *name, long wheel_size, int type, long n, long stall)
+{
+    MESA_timer_t *timer = MESA_timer_create(wheel_size, type);
+    MESA_timer_index_t *index;
+    long curtime = 0, i;
+
+    srand(1);
+    for(i = 0; i < n; i++)
+    {
+        /* timeouts from 1ms to 10 minutes */
+        long timeout = 1000 + (long)((double)rand() / RAND_MAX * 600000000.0);
+        MESA_timer_add(timer, curtime, timeout, event_cb, NULL, NULL, &index);
+    }
+    for(i = 0; i < 100; i++)
+    {
+        curtime += 1000;
+        MESA_timer_check(timer, curtime, n);
+    }
+
+    fired = 0;
+    curtime += stall;
+    double start = now_ns();
+    MESA_timer_check(timer, curtime, n);
+    double cost = now_ns() - start;
+
+    printf("%-8s wheel_size %6ld timers %9ld stall %9ldus: check %10.0f us, fired %ld\n",
+            name, wheel_size, n, stall, cost / 1000, fired);
+    MESA_timer_destroy(timer);
+}
+
+int main(int argc, char *argv[])
+{
+    long n = argc > 1 ? atol(argv[1]) : 1000000;
+    long stall = argc > 2 ? atol(argv[2]) : 5000000;
+
+    bench_stall("wheel", 1000, TM_TYPE_WHEEL, n, stall);
+    bench_stall("wheel", MAX_WHEEL_SIZE, TM_TYPE_WHEEL, n, stall);
+    bench_stall("hwheel", 0, TM_TYPE_HWHEEL, n, stall);
+    bench_stall("heap", 0, TM_TYPE_HEAP, n, stall);
+    return 0;
+}
@@ -0,0 +1,297 @@
+/************************************************
+*				MESA timer benchmark suite
+* Production-like workloads on every timer type,
+* in virtual time (1 tick = 1 ms) without I/O.
+* Each workload and configuration runs in its own
+* process, so that peak RSS is its own.
+* Usage: bench_suite [-n timers] [-w workload] [-c config]
+************************************************/
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+#include<unistd.h>
+#include<sys/resource.h>
+#include<sys/wait.h>
+#include"MESA_timer.h"
+
+typedef struct config_t{
+    const char *name;
+    int type;
+    long wheel_size;
+    int lazy_reset;
+}config_t;
+
+static const config_t configs[] = {
+    {"queue",        TM_TYPE_QUEUE,  0,     0},
+    {"wheel-1000",   TM_TYPE_WHEEL,  1000,  0},
+    {"wheel-10000",  TM_TYPE_WHEEL,  10000, 0},
+    {"wheel-lazy",   TM_TYPE_WHEEL,  10000, 1},
+    {"swheel-1000",  TM_TYPE_SWHEEL, 1000,  0},
+    {"swheel-10000", TM_TYPE_SWHEEL, 10000, 0},
+    {"hwheel",       TM_TYPE_HWHEEL, 0,     0},
+    {"hwheel-lazy",  TM_TYPE_HWHEEL, 0,     1},
+    {"heap",         TM_TYPE_HEAP,   0,     0},
+    {"mqueue",       TM_TYPE_MQUEUE, 64,    0},
+};
+
+/**
+ * A workload: timers start with timeouts spread over init_timeout, then
+ * every tick resets, deletes and re-adds some of them and checks. Timeouts
+ * are multiples of quantum so that a multi-class queue can hold them.
+ **/
+typedef struct workload_t{
+    const char *name;
+    long ticks;
+    long init_timeout;              /* initial timeouts are in (0, init_timeout] */
+    long timeout;                   /* timeouts of resets and adds are in (0, timeout] */
+    long quantum;
+    long resets_per_tick;           /* per 1M timers */
+    long dels_per_tick;             /* per 1M timers */
+    long stall_tick;                /* tick after which time jumps, 0 if none */
+    long stall_ticks;               /* length of the jump */
+    int fixed_timeout;              /* all resets and adds use timeout, queue can run it */
+}workload_t;
+
+static const workload_t workloads[] = {
+    /* flow table: packets refresh the idle timeout of active flows, idle flows expire and are replaced */
+    {"churn",  2000, 30000,  30000,  1000,  20000, 0,     0,   0,     1},
+    /* RPC deadlines: most are cancelled before they time out */
+    {"rpc",    500,  500,    500,    10,    0,     10000, 0,   0,     0},
+    /* long timeouts and a one minute stall of the event loop */
+    {"stall",  200,  600000, 600000, 10000, 0,     0,     100, 60000, 0},
+    /* many timers, steady expiry and replacement */
+    {"steady", 1000, 600,    600,    10,    0,     0,     0,   0,     0},
+};
+
+typedef struct slot_t{
+    MESA_timer_index_t *index;      /* NULL when the slot is free */
+    long id;
+}slot_t;
+
+static slot_t *slots;
+static long *free_slots;
+static long free_cnt;
+static long fired;
+static long add_failed;
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void event_cb(void *event)
+{
+    slot_t *slot = (slot_t *)event;
+    slot->index = NULL;
+    free_slots[free_cnt++] = slot->id;
+    fired ++;
+}
+
+static long rand_long(long n)
+{
+    return (((long)rand() << 31) ^ rand()) % n;
+}
+
+static long rand_timeout(long range, long quantum)
+{
+    return (rand_long(range / quantum) + 1) * quantum;
+}
+
+static int cmp_long(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void run(const workload_t *w, const config_t *c, long n)
+{
+    MESA_timer_opt_t opt;
+    MESA_timer_t *timer;
+    double t, add_ns = 0, del_ns = 0, reset_ns = 0, check_ns = 0, *check_lat;
+    long add_ops = 0, del_ops = 0, reset_ops = 0, tick, now = 0, i, k;
+    long resets = w->resets_per_tick * (n / 1000) / 1000;
+    long dels = w->dels_per_tick * (n / 1000) / 1000;
+    long *timeouts;
+    struct rusage ru;
+
+    MESA_timer_opt_init(&opt);
+    opt.type = c->type;
+    opt.wheel_size = c->wheel_size;
+    opt.lazy_reset = c->lazy_reset;
+    timer = MESA_timer_create_ex(&opt);
+
+    slots = (slot_t *)calloc(n, sizeof(slot_t));
+    free_slots = (long *)malloc(sizeof(long) * n);
+    check_lat = (double *)malloc(sizeof(double) * w->ticks);
+    free_cnt = 0;
+    fired = 0;
+    add_failed = 0;
+    srand(1);
+
+    /* initial timers, in expire order so that a queue accepts them */
+    timeouts = (long *)malloc(sizeof(long) * n);
+    for(i = 0; i < n; i++)
+    {
+        timeouts[i] = rand_timeout(w->init_timeout, w->quantum);
+    }
+    qsort(timeouts, n, sizeof(long), cmp_long);
+    t = now_ns();
+    for(i = 0; i < n; i++)
+    {
+        slots[i].id = i;
+        if(MESA_timer_add(timer, now, timeouts[i], event_cb, &slots[i], NULL, &slots[i].index) != 0)
+            add_failed ++;
+    }
+    add_ns += now_ns() - t;
+    add_ops += n;
+    free(timeouts);
+
+    for(tick = 0; tick < w->ticks; tick++)
+    {
+        now ++;
+        if(w->stall_tick != 0 && tick == w->stall_tick)
+        {
+            now += w->stall_ticks;
+        }
+
+        t = now_ns();
+        for(k = 0; k < resets; k++)
+        {
+            /* even slots are active flows, odd ones go idle */
+            slot_t *slot = &slots[rand_long(n / 2) * 2];
+            if(slot->index != NULL)
+            {
+                MESA_timer_reset(timer, slot->index, now, w->fixed_timeout ? w->timeout : rand_timeout(w->timeout, w->quantum));
+                reset_ops ++;
+            }
+        }
+        reset_ns += now_ns() - t;
+
+        t = now_ns();
+        for(k = 0; k < dels; k++)
+        {
+            slot_t *slot = &slots[rand_long(n)];
+            if(slot->index != NULL)
+            {
+                MESA_timer_del(timer, slot->index);
+                slot->index = NULL;
+                free_slots[free_cnt++] = slot->id;
+                del_ops ++;
+            }
+        }
+        del_ns += now_ns() - t;
+
+        t = now_ns();
+        while(free_cnt > 0)
+        {
+            slot_t *slot = &slots[free_slots[--free_cnt]];
+            if(MESA_timer_add(timer, now, w->fixed_timeout ? w->timeout : rand_timeout(w->timeout, w->quantum),
+                              event_cb, slot, NULL, &slot->index) != 0)
+                add_failed ++;
+            add_ops ++;
+        }
+        add_ns += now_ns() - t;
+
+        t = now_ns();
+        MESA_timer_check(timer, now, n);
+        check_lat[tick] = now_ns() - t;
+        check_ns += check_lat[tick];
+    }
+
+    qsort(check_lat, w->ticks, sizeof(double), cmp_double);
+    getrusage(RUSAGE_SELF, &ru);
+    printf("%-7s %-13s %8.1f %8.1f %8.1f %10.1f %10.1f %10.1f %12.0f %8.1f\n",
+            w->name, c->name,
+            add_ops ? add_ns / add_ops : 0,
+            del_ops ? del_ns / del_ops : 0,
+            reset_ops ? reset_ns / reset_ops : 0,
+            check_ns / w->ticks / 1000,
+            check_lat[(w->ticks * 99) / 100] / 1000,
+            check_lat[w->ticks - 1] / 1000,
+            check_ns > 0 ? fired / (check_ns / 1e9) : 0,
+            ru.ru_maxrss / 1024.0);
+    if(add_failed > 0)
+    {
+        fprintf(stderr, "%s %s: %ld adds failed\n", w->name, c->name, add_failed);
+    }
+
+    MESA_timer_destroy(timer);
+    free(check_lat);
+    free(free_slots);
+    free(slots);
+}
+
+
+
+int main(int argc, char *argv[])
+{
+    const char *workload = NULL, *config = NULL;
+    long n = 1000000;
+    unsigned int i, j;
+    int opt, status;
+    pid_t pid;
+
+    while((opt = getopt(argc, argv, "n:w:c:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'n':
+                n = atol(optarg);
+                break;
+            case 'w':
+                workload = optarg;
+                break;
+            case 'c':
+                config = optarg;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-n timers] [-w workload] [-c config]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(n < 1000)
+    {
+        fprintf(stderr, "timers must be at least 1000\n");
+        return 1;
+    }
+
+    printf("%ld timers, ns/op for add/del/reset, check in us\n", n);
+    printf("%-7s %-13s %8s %8s %8s %10s %10s %10s %12s %8s\n",
+            "load", "config", "add", "del", "reset", "check", "check-p99", "check-max", "expiries/s", "rss-MB");
+    for(i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++)
+    {
+        if(workload != NULL && strcmp(workload, workloads[i].name) != 0)
+            continue;
+        for(j = 0; j < sizeof(configs) / sizeof(configs[0]); j++)
+        {
+            if(config != NULL && strcmp(config, configs[j].name) != 0)
+                continue;
+            /* a queue only holds timers added in expire order */
+            if(configs[j].type == TM_TYPE_QUEUE && !workloads[i].fixed_timeout)
+                continue;
+
+            fflush(stdout);
+            pid = fork();
+            if(pid == 0)
+            {
+                run(&workloads[i], &configs[j], n);
+                fflush(stdout);
+                _exit(0);
+            }
+            if(pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            {
+                fprintf(stderr, "%s %s: failed\n", workloads[i].name, configs[j].name);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,60 @@
+/************************************************
+*				MESA timer benchmark
+* Spoke scan cost: timeouts much longer than the
+* wheel, so every spoke holds many events with
+* rotations to go and few due ones.
+************************************************/
+#include<stdio.h>
+#include<stdlib.h>
+#include<time.h>
+#include"MESA_timer.h"
+
+#define EVENTS 1000000
+#define WHEEL_SIZE 1000
+#define MAX_TIMEOUT 200000
+#define TICKS 20000
+
+static long fired;
+
+static void event_cb(void *event)
+{
+    fired ++;
+}
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench_scan(const char *name, int type)
+{
+    MESA_timer_t *timer = MESA_timer_create(WHEEL_SIZE, type);
+    MESA_timer_index_t *index;
+    double t0, t1;
+    long i;
+
+    srand(1);
+    for(i = 0; i < EVENTS; i++)
+    {
+        MESA_timer_add(timer, 0, rand() % MAX_TIMEOUT, event_cb, NULL, NULL, &index);
+    }
+
+    fired = 0;
+    t0 = now_ns();
+    for(i = 1; i <= TICKS; i++)
+    {
+        MESA_timer_check(timer, i, EVENTS);
+    }
+    t1 = now_ns();
+    printf("%-8s %6.1f us per tick, %ld fired\n", name, (t1 - t0) / TICKS / 1000, fired);
+    MESA_timer_destroy(timer);
+}
+
+int main()
+{
+    bench_scan("wheel", TM_TYPE_WHEEL);
+    bench_scan("swheel", TM_TYPE_SWHEEL);
+    return 0;
+}
@@ -8,6 +8,9 @@
 #ifndef	_MESA_TIMER_INCLUDE_
 #define	_MESA_TIMER_INCLUDE_
 
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -19,24 +22,170 @@ typedef struct{
 typedef struct{
 }MESA_timer_index_t;
 
+/**
+ * A timer node embedded in user's event structure, so that the timer needs no
+ * allocation of its own. Its content is private to timer, and it MUST be
+ * zeroed before it is added for the first time.
+ **/
+typedef struct{
+    long __opaque[8];
+}MESA_timer_node_t;
+
+/* Get the structure of type which embeds node as member */
+#define MESA_timer_node_entry(node, type, member) \
+    ((type *)((char *)(node) - offsetof(type, member)))
+
+/**
+ * A 32-bit handle of an event, given by MESA_timer_add_h: a 24-bit element
+ * index and an 8-bit generation by default. A handle whose event has timed
+ * out or been deleted is stale and always rejected: an element is retired
+ * instead of reused when its generation would wrap, which costs one element
+ * per 255 reuses.
+ **/
+typedef uint32_t MESA_timer_handle_t;
+
+#define MESA_TIMER_HANDLE_INVALID 0
+
 typedef void (*timeout_cb_t)(void *event);
 typedef void (*event_free_cb_t)(void *event);
 
+/* An expired event handed out by MESA_timer_check_collect */
+typedef struct{
+    void *event;
+    timeout_cb_t timeout_cb;
+    event_free_cb_t free_cb;
+}MESA_timer_expired_t;
+
+/* An expired event handed out by MESA_timer_check_inflight */
+typedef struct{
+    void *event;
+    timeout_cb_t timeout_cb;
+    event_free_cb_t free_cb;
+    MESA_timer_index_t *index;      /* given back by MESA_timer_inflight_done */
+}MESA_timer_inflight_t;
+
+/**
+ * Statistics of a timer, got by MESA_timer_stats. Histogram bucket 0 counts
+ * values <= 0, bucket i counts values in [2^(i-1), 2^i), the last bucket
+ * also counts larger values.
+ **/
+#define MESA_TIMER_HIST_BUCKETS 32
+
+typedef struct{
+    long add_cnt;                   /* events added */
+    long del_cnt;                   /* events deleted */
+    long reset_cnt;                 /* calls of reset */
+    long check_cnt;                 /* calls of MESA_timer_check and MESA_timer_check_collect */
+    long visited_cnt;               /* events examined by checks: swept, cascaded or popped */
+    long fired_cnt;                 /* callbacks invoked and events collected */
+    long deferred_cnt;              /* checks returning with due events left by max_cb_times */
+    long lateness_hist[MESA_TIMER_HIST_BUCKETS];    /* current_time - expire when fired */
+    long callback_hist[MESA_TIMER_HIST_BUCKETS];    /* nanoseconds of timeout_cb, sampled
+                                                     * on one of 16 callbacks */
+    long occupancy_hist[MESA_TIMER_HIST_BUCKETS];   /* events per spoke of time wheels, slot of
+                                                     * hierarchical wheel or class of multi-class
+                                                     * queue, empty ones in bucket 0 */
+}MESA_timer_stats_t;
+
+/**
+ * Called by MESA_timer_snapshot for each event to write it into buf of size
+ * bytes. Return the length of the serialized event, the callback is called
+ * again with a larger buf when it is larger than size; return -1 to leave
+ * the event out of the snapshot.
+ **/
+typedef long (*event_serialize_cb_t)(void *event, timeout_cb_t timeout_cb, void *buf, long size, void *arg);
+
+/* An event rebuilt by event_deserialize_cb_t */
+typedef struct{
+    void *event;
+    timeout_cb_t timeout_cb;
+    event_free_cb_t free_cb;
+    MESA_timer_index_t **index;     /* index of the restored event is stored here, NULL if not needed */
+}MESA_timer_restored_t;
+
+/**
+ * Called by MESA_timer_restore for each saved event with the data written
+ * by event_serialize_cb_t. Fill restored and return 0, or return -1 to
+ * leave the event out.
+ **/
+typedef int (*event_deserialize_cb_t)(const void *data, long len, MESA_timer_restored_t *restored, void *arg);
+
 #define	TM_TYPE_QUEUE 0
 #define	TM_TYPE_WHEEL 1
+#define	TM_TYPE_HWHEEL 2
+#define	TM_TYPE_HEAP 3
+#define	TM_TYPE_MQUEUE 4
+#define	TM_TYPE_SWHEEL 5
 
 #define MAX_WHEEL_SIZE 10000
 
+/* Clock of the *_now functions */
+#define MESA_TIMER_CLOCK_NONE 0     /* user passes current_time, *_now fail */
+#define MESA_TIMER_CLOCK_COARSE 1   /* CLOCK_MONOTONIC_COARSE, as fine as a kernel tick */
+#define MESA_TIMER_CLOCK_TSC 2      /* the invariant TSC calibrated to CLOCK_MONOTONIC, or
+                                     * MESA_TIMER_CLOCK_COARSE when the CPU has none */
+
+/* Flags of MESA_timer_add_periodic */
+#define MESA_TIMER_PERIODIC_DRIFT_FREE 0x1      /* expire n is first + n * interval, late callbacks do not shift it */
+#define MESA_TIMER_PERIODIC_SKIP_MISSED 0x2     /* with DRIFT_FREE, periods missed by a stall fire once, not one by one */
+
+/* Options of MESA_timer_create_ex, initialize it by MESA_timer_opt_init */
+typedef struct{
+    int type;                   /* timer's type, TM_TYPE_QUEUE by default */
+    long wheel_size;            /* the same as wheel_size of MESA_timer_create, 0 by default */
+    long prealloc_elems;        /* timer elements allocated when creating, 0 by default */
+    long slab_elems;            /* timer elements per slab when the node pool grows, it is
+                                 * rounded up to a power of 2, 256 by default */
+    int lazy_reset;             /* for TM_TYPE_WHEEL, TM_TYPE_HWHEEL and TM_TYPE_SWHEEL, a reset
+                                 * which delays an event only stores its new expire, and the
+                                 * event is filed again when its old expire comes. 0 by default */
+    int slack_pct;              /* events may time out late by up to slack_pct percent of their
+                                 * timeout: MESA_timer_add and MESA_timer_reset round deadlines
+                                 * up to shared aligned times, so expiries cluster into fewer
+                                 * checks. Ignored by TM_TYPE_QUEUE and TM_TYPE_MQUEUE. 0 by default */
+    long max_elems;             /* limit of MESA_timer_count, 0 for unlimited by default */
+    long max_bytes;             /* limit of MESA_timer_memsize when the element pool grows, arrays
+                                 * of TM_TYPE_HEAP and TM_TYPE_SWHEEL are not limited. 0 for
+                                 * unlimited by default */
+    long evict_batch;           /* when an add would exceed a limit, the timer first calls
+                                 * timeout_cb of this many events with the nearest expire, as
+                                 * if they timed out at the add's current_time, until the add
+                                 * fits. 64 by default */
+    int auto_resize;            /* for TM_TYPE_WHEEL, wheel_size follows the timeouts added and
+                                 * reset: a revolution is kept near the 90th percentile of them,
+                                 * within [64, MAX_WHEEL_SIZE], see MESA_timer_resize. 0 by default */
+    int clock;                  /* MESA_TIMER_CLOCK_*, MESA_TIMER_CLOCK_NONE by default */
+    long clock_res_ns;          /* nanoseconds of a tick of the clock, the time of the *_now
+                                 * functions is CLOCK_MONOTONIC in these ticks, the same as
+                                 * MESA_timer_driver_now of an equal tick_nsec. 1000000 by default */
+}MESA_timer_opt_t;
+
 /**
  * Description:
- *     Create a timer with type of TS_TYPE. Until now we support queue
- *     and time wheel.
+ *     Create a timer with type of TS_TYPE. Until now we support queue,
+ *     time wheel, hierarchical time wheel, time heap, multi-class queue and
+ *     array backed time wheel.
  * Params:
- *     wheel_size: When timer's type is TM_TYPE_QUEUE, wheel_size is unused. It is
- *                the size to initlize time wheel
+ *     wheel_size: It is the size to initlize time wheel and array backed time
+ *                wheel. For TM_TYPE_MQUEUE it is the max count of distinct
+ *                timeouts, 0 means 16 and it MUST <= 64. For other types,
+ *                wheel_size is unused.
  *     TS_TYPE: It is a micro defination for timer's type.
  *              TM_TYPE_QUEUE represents double linedlist,
- *              TM_TYPE_WHEEL represents time wheel.
+ *              TM_TYPE_WHEEL represents time wheel,
+ *              TM_TYPE_HWHEEL represents multi-level cascading time wheel. It
+ *              has no size limit: a timeout up to 2^38 ticks is filed into one
+ *              of six levels and cascaded down as time goes, longer timeouts
+ *              are parked at the top level and refiled until they are due.
+ *              TM_TYPE_HEAP represents 4-ary min heap, it accepts timeouts in
+ *              any order and deletes or resets an event in O(log n).
+ *              TM_TYPE_MQUEUE represents one double linkedlist per distinct
+ *              timeout, so events of different timeouts may be mixed. Adding
+ *              a timeout beyond the max count of distinct timeouts fails.
+ *              TM_TYPE_SWHEEL represents time wheel whose spokes are arrays of
+ *              rotations and events instead of linkedlists, a spoke is checked
+ *              by SIMD compare without touching its events, and deleting an
+ *              event moves the last one of its spoke into its place.
  *  Return:
  *     On success, return a timer, else return NULL
  *
@@ -44,6 +193,31 @@ typedef void (*event_free_cb_t)(void *event);
 MESA_timer_t *MESA_timer_create(long wheel_size, int TM_TYPE);
 
 
+/**
+ * Description:
+ *     Fill opt with default options.
+ * Params:
+ *     opt: Options to initialize.
+ * Return:
+ *     void
+ **/
+void MESA_timer_opt_init(MESA_timer_opt_t *opt);
+
+
+/**
+ * Description:
+ *     Create a timer by options. Timer elements are allocated from slabs owned
+ *     by the timer: an element freed by MESA_timer_del or after its timeout is
+ *     reused by the following adds, and all slabs are freed together by
+ *     MESA_timer_destroy.
+ * Params:
+ *     opt: Options initialized by MESA_timer_opt_init and then modified.
+ * Return:
+ *     On success, return a timer, else return NULL
+ **/
+MESA_timer_t *MESA_timer_create_ex(const MESA_timer_opt_t *opt);
+
+
 /**
  * Description:
  *     Add a timeout work to a given timer
@@ -56,6 +230,8 @@ MESA_timer_t *MESA_timer_create(long wheel_size, int TM_TYPE);
  *     free_cb: event's free callback function.
  *     index: Address(Index) of the timer_node pointer related to the event is
  *            stored in index.
+ *     When timer has max_elems or max_bytes, callbacks of other events may be
+ *     called before this returns, see MESA_timer_opt_t.
  * Return:
  *      On success 0 is returned, else -1 is returned
  **/
@@ -68,6 +244,143 @@ int MESA_timer_add(MESA_timer_t *timer,
                    MESA_timer_index_t **index);
 
 
+/**
+ * Description:
+ *     The same as MESA_timer_add, but the work may time out up to slack later
+ *     than current_time + timeout, instead of by timer's slack_pct. Its
+ *     deadline is rounded up to the time with most trailing zero bits in the
+ *     range, which it likely shares with other works. TM_TYPE_QUEUE and
+ *     TM_TYPE_MQUEUE ignore slack.
+ * Params:
+ *     slack: Ticks the work may be late, It MUST >= 0
+ *     others: See MESA_timer_add.
+ * Return:
+ *      On success 0 is returned, else -1 is returned
+ **/
+int MESA_timer_add_slack(MESA_timer_t *timer,
+                         long current_time,
+                         long timeout,
+                         long slack,
+                         timeout_cb_t timeout_cb,
+                         void* event,
+                         event_free_cb_t free_cb,
+                         MESA_timer_index_t **index);
+
+
+/**
+ * Description:
+ *     Add a work timing out first ticks later and then every interval ticks,
+ *     until it is deleted. Its element is filed again after each callback,
+ *     neither freed nor allocated. By default the next period starts when the
+ *     callback fires, so lateness adds up; flags keep an absolute schedule.
+ *     A callback may reset or delete its own work, deleting stops it and
+ *     free_cb is called after the callback. MESA_timer_check_collect files
+ *     it again before returning and hands it out with free_cb NULL, so does
+ *     MESA_timer_check_inflight until it is done, and hands free_cb back if
+ *     it cannot be filed again. TM_TYPE_QUEUE files it no earlier than its
+ *     last expire, TM_TYPE_MQUEUE needs classes for both first and interval.
+ *     Works evicted by max_elems or max_bytes are not filed again, and
+ *     MESA_timer_snapshot saves its next expire, interval and flags.
+ * Params:
+ *     first: Timeout of the first period. It MUST >= 0
+ *     interval: Ticks between periods. It MUST > 0
+ *     flags: 0 or MESA_TIMER_PERIODIC_* ORed.
+ *     others: See MESA_timer_add.
+ * Return:
+ *      On success 0 is returned, else -1 is returned
+ **/
+int MESA_timer_add_periodic(MESA_timer_t *timer,
+                            long current_time,
+                            long first,
+                            long interval,
+                            int flags,
+                            timeout_cb_t timeout_cb,
+                            void* event,
+                            event_free_cb_t free_cb,
+                            MESA_timer_index_t **index);
+
+
+/**
+ * Description:
+ *     Add a burst of timeout works sharing the same callbacks to a given timer.
+ *     It is the same as calling MESA_timer_add for each work with the same
+ *     current_time, but dispatches, computes time and allocates once a batch.
+ * Params:
+ *     timer: The timer returned by MESA_timer_create function.
+ *     current_time: The current time when add the works. It MUST >= 0
+ *     n: Count of works.
+ *     timeouts: Array of n works' timeout time. They MUST >= 0
+ *     events: Array of n events.
+ *     timeout_cb: Callback function of all the works when timeout.
+ *     free_cb: events' free callback function.
+ *     indexes: Array of n, index of each work is stored here, NULL if the
+ *              work cannot be added like MESA_timer_add returns -1.
+ * Return:
+ *      Return the count of works added, -1 when timer's type is unknown.
+ **/
+long MESA_timer_add_batch(MESA_timer_t *timer,
+                          long current_time,
+                          long n,
+                          const long *timeouts,
+                          void **events,
+                          timeout_cb_t timeout_cb,
+                          event_free_cb_t free_cb,
+                          MESA_timer_index_t **indexes);
+
+
+/**
+ * Description:
+ *     Add a timeout work to a given timer with a node embedded in the event,
+ *     timer neither allocates nor frees anything for the work. When timeout,
+ *     timeout_cb is called with node, use MESA_timer_node_entry to get the
+ *     event. The event may be freed in timeout_cb, timer does not touch the
+ *     node after calling it. There is no free_cb: MESA_timer_del_node and
+ *     MESA_timer_destroy only take the node out of timer.
+ * Params:
+ *     timer: The timer returned by MESA_timer_create function.
+ *     current_time: The current time when add the timer element. It MUST >= 0
+ *     timeout: The work's timeout time. It MUST >= 0
+ *     timeout_cb: Callback function of the work when timeout, its argument is
+ *                 node.
+ *     node: The node embedded in the event. It MUST NOT be in a timer, use
+ *           MESA_timer_reset_node to move a node in timer.
+ * Return:
+ *      On success 0 is returned, else -1 is returned, also when node is
+ *      already in a timer
+ **/
+int MESA_timer_add_node(MESA_timer_t *timer,
+                        long current_time,
+                        long timeout,
+                        timeout_cb_t timeout_cb,
+                        MESA_timer_node_t *node);
+
+
+/**
+ * Description:
+ *     The same as MESA_timer_add, but return a handle of the work instead of
+ *     its index. Elements of a timer are indexed in 24 bits by default, so
+ *     at most 2^24 works, retired elements included, hold handles.
+ * Params:
+ *     timer: The timer returned by MESA_timer_create function.
+ *     current_time: The current time when add the timer element. It MUST >= 0
+ *     timeout: The work's timeout time. It MUST >= 0
+ *     timeout_cb: It is callback function of a work when timeout.
+ *     event: It is the event for user to define.
+ *     free_cb: event's free callback function.
+ *     handle: The work's handle is stored in handle, MESA_TIMER_HANDLE_INVALID
+ *             on failure.
+ * Return:
+ *      On success 0 is returned, else -1 is returned
+ **/
+int MESA_timer_add_h(MESA_timer_t *timer,
+                     long current_time,
+                     long timeout,
+                     timeout_cb_t timeout_cb,
+                     void *event,
+                     event_free_cb_t free_cb,
+                     MESA_timer_handle_t *handle);
+
+
 /**
  * Description:
  *     Delete a MESA_timer_index_t from timer, and then execute callback function.
@@ -75,12 +388,40 @@ int MESA_timer_add(MESA_timer_t *timer,
  *     timer: The timer created by MESA_timer_create.
  *     index: MESA_timer_index_t structure returned by MESA_timer_add function.
  *            Now we want to delete it.
+ *     A periodic work deleted by its own callback, or while in flight, is
+ *     stopped and released after its callback.
  * Return:
  *     On success, return the event's expire. Otherwise -1 is returned.
  **/
 long MESA_timer_del(MESA_timer_t *timer, MESA_timer_index_t *index);
 
 
+/**
+ * Description:
+ *     Delete a node added by MESA_timer_add_node from timer. Deleting a node
+ *     which has timed out or been deleted is harmless.
+ * Params:
+ *     timer: The timer created by MESA_timer_create.
+ *     node: The node to delete.
+ * Return:
+ *     On success, return the event's expire. Otherwise -1 is returned.
+ **/
+long MESA_timer_del_node(MESA_timer_t *timer, MESA_timer_node_t *node);
+
+
+/**
+ * Description:
+ *     Delete a work added by MESA_timer_add_h from timer, then call free_cb.
+ *     A stale handle is rejected in O(1).
+ * Params:
+ *     timer: The timer created by MESA_timer_create.
+ *     handle: The handle returned by MESA_timer_add_h.
+ * Return:
+ *     On success, return the event's expire. Otherwise -1 is returned.
+ **/
+long MESA_timer_del_h(MESA_timer_t *timer, MESA_timer_handle_t handle);
+
+
 /**
  * Description:
  *     This function is called by user one or severial times every time_tick.
@@ -99,6 +440,62 @@ long MESA_timer_del(MESA_timer_t *timer, MESA_timer_index_t *index);
 long MESA_timer_check(MESA_timer_t *timer, long current_time, long max_cb_times);
 
 
+/**
+ * Description:
+ *     The same as MESA_timer_check, but instead of invoking callbacks it hands
+ *     expired events out to the caller, who may then process them in a tight
+ *     loop. Timer elements of the events are released, their indexes become
+ *     invalid, and neither timeout_cb nor free_cb is called by timer.
+ * Params:
+ *     timer: The same as upper funtion.
+ *     current_time: The same as upper funtion.
+ *     expired: Array of at least max_cnt to store expired events with their
+ *              callbacks.
+ *     max_cnt: Max count of events to hand out.
+ * Return:
+ *     Return the count of events stored in expired, 0 means no timeout event.
+ *     Return -1 when error occurs.
+ **/
+long MESA_timer_check_collect(MESA_timer_t *timer, long current_time, MESA_timer_expired_t *expired, long max_cnt);
+
+
+/**
+ * Description:
+ *     The same as MESA_timer_check_collect, but the timer elements stay in
+ *     flight until MESA_timer_inflight_done, so that other threads may run
+ *     timeout_cb and free_cb: MESA_timer_del and MESA_timer_reset of them,
+ *     with their indexes or handles, return -1 meanwhile, but a periodic work
+ *     is stopped by MESA_timer_del. A periodic work is filed again by the
+ *     next check after it is done, or its free_cb is called there if it was
+ *     stopped. Nodes added by
+ *     MESA_timer_add_node are user's memory, which their callbacks may free,
+ *     their callbacks are called here instead and count in max_cnt.
+ * Params:
+ *     timer: The same as upper funtion.
+ *     current_time: The same as upper funtion.
+ *     inflight: Array of at least max_cnt to store expired events.
+ *     max_cnt: Max count of events to hand out or call back.
+ * Return:
+ *     Return the count of events stored in inflight, -1 when error occurs.
+ **/
+long MESA_timer_check_inflight(MESA_timer_t *timer, long current_time, MESA_timer_inflight_t *inflight, long max_cnt);
+
+
+/**
+ * Description:
+ *     Give back an event handed out by MESA_timer_check_inflight after its
+ *     callbacks, from any thread and without locking. The timer element is
+ *     released by the next check of timer on its own thread. Timer MUST NOT
+ *     be destroyed while events are in flight.
+ * Params:
+ *     timer: Timer which handed out the event.
+ *     index: index of MESA_timer_inflight_t.
+ * Return:
+ *     void
+ **/
+void MESA_timer_inflight_done(MESA_timer_t *timer, MESA_timer_index_t *index);
+
+
 /**
  * Description:
  *     Destroy the given timer, free the memory and execute callback function.
@@ -128,12 +525,40 @@ long MESA_timer_count(MESA_timer_t *timer);
  * Params:
  *     timer: Timer returned by MESA_timer_create function.
  * Return:
- *     Return the memory occupancy of timer.
+ *     Return the memory occupancy of timer, including all slabs of timer
+ *     elements whether they are in use or not.
  **/
 
 long MESA_timer_memsize(MESA_timer_t *timer);
 
 
+/**
+ * Description:
+ *     Get count of events whose timeout_cb was called before their expire,
+ *     to keep timer in max_elems and max_bytes.
+ * Params:
+ *     timer: Timer returned by MESA_timer_create function.
+ * Return:
+ *     Return the count since timer was created.
+ **/
+long MESA_timer_early_expired(MESA_timer_t *timer);
+
+
+/**
+ * Description:
+ *     Change wheel_size of a TM_TYPE_WHEEL timer without draining it. Events
+ *     keep their expire, they stay in the old spokes and are moved a part at
+ *     a time by the following MESA_timer_check calls, every old spoke before
+ *     the ticks pass it, so no check moves all of them at once.
+ * Params:
+ *     timer: Timer returned by MESA_timer_create function.
+ *     new_size: New size of the time wheel, in (0, MAX_WHEEL_SIZE].
+ * Return:
+ *     On success, 0 is returned, else -1 is returned.
+ **/
+int MESA_timer_resize(MESA_timer_t *timer, long new_size);
+
+
 /**
  * Description:
  *     Reset an existing timer element to new current_time and timeout.
@@ -147,6 +572,195 @@ long MESA_timer_memsize(MESA_timer_t *timer);
  **/
 int MESA_timer_reset(MESA_timer_t *timer, MESA_timer_index_t *index, long current_time, long timeout);
 
+
+/**
+ * Description:
+ *     The same as MESA_timer_reset, but the element may time out up to slack
+ *     later, like MESA_timer_add_slack.
+ * Params:
+ *     slack: Ticks the element may be late, It MUST >= 0
+ *     others: See MESA_timer_reset.
+ * Return:
+ *     On success, 0 is returned, else -1 is returned.
+ **/
+int MESA_timer_reset_slack(MESA_timer_t *timer, MESA_timer_index_t *index, long current_time, long timeout, long slack);
+
+
+/**
+ * Description:
+ *     Reset a node added by MESA_timer_add_node to new current_time and
+ *     timeout, the node is added back if it has timed out or been deleted.
+ * Params:
+ *     timer: The timer returned by MESA_timer_create function.
+ *     node: The node added by MESA_timer_add_node.
+ *     current_time: current time.
+ *     timeout: relative timeout of the node.
+ * Return:
+ *     On success, 0 is returned, else -1 is returned.
+ **/
+int MESA_timer_reset_node(MESA_timer_t *timer, MESA_timer_node_t *node, long current_time, long timeout);
+
+
+/**
+ * Description:
+ *     Reset a work added by MESA_timer_add_h to new current_time and timeout.
+ *     A stale handle is rejected in O(1); a work may be reset by its own
+ *     timeout_cb, as MESA_timer_reset does.
+ * Params:
+ *     timer: The timer returned by MESA_timer_create function.
+ *     handle: The handle returned by MESA_timer_add_h.
+ *     current_time: current time.
+ *     timeout: relative timeout of the work.
+ * Return:
+ *     On success, 0 is returned, else -1 is returned.
+ **/
+int MESA_timer_reset_h(MESA_timer_t *timer, MESA_timer_handle_t handle, long current_time, long timeout);
+
+
+/**
+ * Description:
+ *     Get the time of timer's clock, it is read by MESA_timer_check_now and
+ *     when creating timer, not by this function.
+ * Params:
+ *     timer: Timer created with a clock in MESA_timer_opt_t.
+ * Return:
+ *     Return the time in ticks of clock_res_ns, -1 if timer has no clock.
+ **/
+long MESA_timer_now(MESA_timer_t *timer);
+
+
+/**
+ * Description:
+ *     Read timer's clock once, then the same as MESA_timer_check at that
+ *     time. It is the only function reading the clock, so adds and resets
+ *     between two checks cost no clock read, and all of them use the time
+ *     of the last check.
+ * Params:
+ *     timer: Timer created with a clock in MESA_timer_opt_t.
+ *     max_cb_times: See MESA_timer_check.
+ * Return:
+ *     Return execute times of callback, -1 if timer has no clock.
+ **/
+long MESA_timer_check_now(MESA_timer_t *timer, long max_cb_times);
+
+
+/**
+ * Description:
+ *     MESA_timer_add, MESA_timer_add_h, MESA_timer_reset and
+ *     MESA_timer_reset_h at MESA_timer_now instead of current_time.
+ * Params:
+ *     See the functions without _now.
+ * Return:
+ *     See the functions without _now, -1 if timer has no clock.
+ **/
+int MESA_timer_add_now(MESA_timer_t *timer,
+                       long timeout,
+                       timeout_cb_t timeout_cb,
+                       void *event,
+                       event_free_cb_t free_cb,
+                       MESA_timer_index_t **index);
+
+int MESA_timer_add_h_now(MESA_timer_t *timer,
+                         long timeout,
+                         timeout_cb_t timeout_cb,
+                         void *event,
+                         event_free_cb_t free_cb,
+                         MESA_timer_handle_t *handle);
+
+int MESA_timer_reset_now(MESA_timer_t *timer, MESA_timer_index_t *index, long timeout);
+
+int MESA_timer_reset_h_now(MESA_timer_t *timer, MESA_timer_handle_t handle, long timeout);
+
+
+/**
+ * Description:
+ *     Get the time when MESA_timer_check should be called next, so that an
+ *     event loop may sleep until then instead of checking every tick.
+ *     Time queue, time heap and multi-class queue return the earliest expire.
+ *     Time wheel returns the time when its nearest non-empty spoke is checked,
+ *     hierarchical time wheel returns the time when its nearest non-empty
+ *     slot fires or cascades; the events there may still have rotations or
+ *     levels to go, or be delayed by lazy resets, so it is never later than
+ *     the earliest expire but may be earlier. An earlier value than current time means to check at once.
+ * Params:
+ *     timer: Timer returned by MESA_timer_create function.
+ * Return:
+ *     Return the time in the same accuracy with MESA_timer_check's
+ *     current_time, or -1 when there is no event in timer.
+ **/
+long MESA_timer_next_expire(MESA_timer_t *timer);
+
+
+/**
+ * Description:
+ *     Get statistics of timer. Counters are kept since creating or the last
+ *     MESA_timer_stats_reset, while occupancy_hist is counted now by walking
+ *     the spokes, which takes O(events) for linkedlist spokes. Statistics are
+ *     not kept when the library is compiled with MESA_TIMER_NO_STATS.
+ * Params:
+ *     timer: Timer returned by MESA_timer_create function.
+ *     stats: Statistics are stored here.
+ * Return:
+ *     On success, 0 is returned, -1 when statistics are compiled out.
+ **/
+int MESA_timer_stats(MESA_timer_t *timer, MESA_timer_stats_t *stats);
+
+
+/**
+ * Description:
+ *     Clear counters and histograms of timer, e.g. to get rates by intervals.
+ * Params:
+ *     timer: Timer returned by MESA_timer_create function.
+ * Return:
+ *     void
+ **/
+void MESA_timer_stats_reset(MESA_timer_t *timer);
+
+
+/**
+ * Description:
+ *     Save all events of timer to a file with their remaining time, for a
+ *     restarted process to restore. The file is a header and 8-byte aligned
+ *     records, and for the time wheels it keeps each event's spoke and
+ *     rotation with the wheel's position. It is written to path.tmp and
+ *     renamed to path. Events stay in timer, periodic ones keep their interval
+ *     and flags, and events added by MESA_timer_add_node are not saved.
+ * Params:
+ *     timer: Timer returned by MESA_timer_create function.
+ *     path: The snapshot file.
+ *     current_time: Current time, remaining time of an event is its expire
+ *                   minus current_time.
+ *     serialize: Callback writing an event.
+ *     arg: Passed to serialize.
+ * Return:
+ *     Return count of events saved, -1 when error occurs.
+ **/
+long MESA_timer_snapshot(MESA_timer_t *timer, const char *path, long current_time,
+                         event_serialize_cb_t serialize, void *arg);
+
+
+/**
+ * Description:
+ *     Add events saved by MESA_timer_snapshot to timer, each of them times out
+ *     after its remaining time from current_time. The file is mapped and read
+ *     in place. When timer is an empty time wheel or array backed time wheel
+ *     of the snapshot's type and wheel_size, the wheel's position is restored
+ *     and events are put back to their spokes without computing. Otherwise
+ *     they are added one by one, a queue may refuse them. max_elems and
+ *     max_bytes are not applied.
+ * Params:
+ *     timer: Timer returned by MESA_timer_create function.
+ *     path: The snapshot file.
+ *     current_time: Current time.
+ *     deserialize: Callback rebuilding an event.
+ *     arg: Passed to deserialize.
+ * Return:
+ *     Return count of events restored, -1 when the file cannot be read or is
+ *     not a snapshot.
+ **/
+long MESA_timer_restore(MESA_timer_t *timer, const char *path, long current_time,
+                        event_deserialize_cb_t deserialize, void *arg);
+
 #ifdef	__cplusplus
 }
 #endif
@@ -0,0 +1,556 @@
+/************************************************
+*				MESA timer C++ API
+* Header only time wheel with the semantics of
+* TM_TYPE_WHEEL: the wheel size is a template
+* argument, so that a power of 2 is masked and
+* shifted, and the callback is a functor which
+* the compiler inlines into check.
+************************************************/
+
+#ifndef	_MESA_TIMER_HPP_INCLUDE_
+#define	_MESA_TIMER_HPP_INCLUDE_
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+namespace mesa {
+
+/**
+ * Description:
+ *     A time wheel of WheelSize spokes holding events of type Event. Time is
+ *     in ticks given by user, like MESA_timer_create with TM_TYPE_WHEEL: the
+ *     first add starts the wheel, an event added at current_time with
+ *     timeout is called back by the first check whose current_time passes
+ *     its spoke, and check catches up a long gap in one pass.
+ *     Callback is called as callback(event) with Event &, the event is
+ *     destroyed after it returns unless the callback reset it by its handle.
+ *     Spokes live in the object, WheelSize * 2 pointers, so large wheels are
+ *     better created by new. A TimerWheel is neither copied nor moved.
+ **/
+template<class Event, class Callback, long WheelSize>
+class TimerWheel
+{
+    static_assert(WheelSize > 0, "WheelSize must be positive");
+
+    struct Link
+    {
+        Link *prev;
+        Link *next;
+    };
+
+    enum
+    {
+        NOT_IN_TIMER = 0,
+        IN_TIMER,
+    };
+
+    static const long EXPIRED_CURSOR = -1;
+
+    /* a power of 2 wheel divides by shifting */
+    static const bool POW2 = (WheelSize & (WheelSize - 1)) == 0;
+    static const int SHIFT = POW2 ? __builtin_ctzl(WheelSize) : 0;
+
+    static const int WORD_BITS = sizeof(unsigned long) * 8;
+    static const long WORDS = (WheelSize + WORD_BITS - 1) / WORD_BITS;
+
+    /* nodes allocated at once when the pool is empty */
+    static const long SLAB_NODES = 256;
+
+    struct Node
+    {
+        Link link;              /* in a spoke, the expired list or the free list */
+        long expire;
+        long rotation_cnt;
+        long cursor;            /* spoke, EXPIRED_CURSOR in the expired list */
+        unsigned int gen;       /* bumped when the node is released, so that stale handles miss */
+        int status;
+        typename std::aligned_storage<sizeof(Event), alignof(Event)>::type storage;
+
+        Event &event()
+        {
+            return *reinterpret_cast<Event *>(&storage);
+        }
+    };
+
+    struct Slab
+    {
+        Slab *next;
+        Node nodes[SLAB_NODES];
+    };
+
+public:
+    /**
+     * A pending event. Destroying or assigning over a handle cancels its
+     * event, release() leaves the event to time out on its own. A handle
+     * MUST NOT outlive its wheel. It is only moved, never copied.
+     **/
+    class Handle
+    {
+    public:
+        Handle() : wheel_(NULL), node_(NULL), gen_(0)
+        {
+        }
+
+        Handle(Handle &&other) : wheel_(other.wheel_), node_(other.node_), gen_(other.gen_)
+        {
+            other.node_ = NULL;
+        }
+
+        Handle &operator=(Handle &&other)
+        {
+            if(this != &other)
+            {
+                cancel();
+                wheel_ = other.wheel_;
+                node_ = other.node_;
+                gen_ = other.gen_;
+                other.node_ = NULL;
+            }
+            return *this;
+        }
+
+        Handle(const Handle &) = delete;
+        Handle &operator=(const Handle &) = delete;
+
+        ~Handle()
+        {
+            cancel();
+        }
+
+        /* The event is in the wheel and not called back yet */
+        bool pending() const
+        {
+            return live() && node_->status == IN_TIMER;
+        }
+
+        /* The event, valid while the handle is live, also within its callback */
+        Event *get() const
+        {
+            return live() ? &(node_->event()) : NULL;
+        }
+
+        /* Remove the event without calling back, return false if it is gone */
+        bool cancel()
+        {
+            bool ret = pending();
+            if(ret)
+            {
+                wheel_->remove(node_);
+                wheel_->release(node_);
+            }
+            node_ = NULL;
+            return ret;
+        }
+
+        /**
+         * Move the event to current_time + timeout, like MESA_timer_reset.
+         * Within the event's own callback it arms the event again. Return
+         * false if the event is gone.
+         **/
+        bool reset(long current_time, long timeout)
+        {
+            if(!live())
+                return false;
+            wheel_->reset(node_, current_time, timeout);
+            return true;
+        }
+
+        /* Forget the event, it stays in the wheel until it times out */
+        void release()
+        {
+            node_ = NULL;
+        }
+
+    private:
+        friend class TimerWheel;
+
+        Handle(TimerWheel *wheel, Node *node) : wheel_(wheel), node_(node), gen_(node->gen)
+        {
+        }
+
+        bool live() const
+        {
+            return node_ != NULL && node_->gen == gen_;
+        }
+
+        TimerWheel *wheel_;
+        Node *node_;
+        unsigned int gen_;
+    };
+
+    explicit TimerWheel(const Callback &callback = Callback())
+        : callback_(callback), create_time_(-1), last_check_relative_tick_(-1),
+          spoke_index_(0), elem_cnt_(0), free_list_(NULL), slabs_(NULL)
+    {
+        long i;
+        for(i = 0; i < WheelSize; i++)
+        {
+            list_init(&spokes_[i]);
+        }
+        for(i = 0; i < WORDS; i++)
+        {
+            bitmap_[i] = 0;
+        }
+        list_init(&expired_);
+    }
+
+    TimerWheel(const TimerWheel &) = delete;
+    TimerWheel &operator=(const TimerWheel &) = delete;
+
+    /* Pending events are destroyed without calling back */
+    ~TimerWheel()
+    {
+        long i;
+        for(i = 0; i < WheelSize; i++)
+        {
+            destroy_list(&spokes_[i]);
+        }
+        destroy_list(&expired_);
+        while(slabs_ != NULL)
+        {
+            Slab *slab = slabs_;
+            slabs_ = slab->next;
+            ::operator delete(slab);
+        }
+    }
+
+    /**
+     * Add an event timing out at current_time + timeout, like MESA_timer_add.
+     * The returned handle cancels the event when destroyed, unless released.
+     **/
+    Handle add(long current_time, long timeout, Event event)
+    {
+        Node *node = acquire();
+        new (&(node->storage)) Event(std::move(event));
+
+        /* the first event starts the wheel, and current_time's relative time is 0 */
+        if(last_check_relative_tick_ == -1)
+        {
+            create_time_ = current_time;
+            spoke_index_ = 0;
+            last_check_relative_tick_ = 0;
+        }
+        node->expire = current_time + timeout;
+        insert(node);
+        node->status = IN_TIMER;
+        elem_cnt_ ++;
+        return Handle(this, node);
+    }
+
+    /**
+     * Call back events due at current_time, at most max_cb_times of them,
+     * like MESA_timer_check. Return count of callbacks.
+     **/
+    long check(long current_time, long max_cb_times)
+    {
+        long cb_cnt = fire_expired(max_cb_times);
+        if(!list_empty(&expired_))
+            return cb_cnt;
+        gather_expired(current_time, max_cb_times - cb_cnt);
+        return cb_cnt + fire_expired(max_cb_times - cb_cnt);
+    }
+
+    /* Earliest time check calls back an event, -1 if none, like MESA_timer_next_expire */
+    long next_expire() const
+    {
+        if(!list_empty(&expired_))
+            return node_of(expired_.next)->expire;
+        if(create_time_ == -1)
+            return -1;
+
+        /* events of a spoke time out one tick after the spoke's relative tick */
+        long distance = next_distance();
+        if(distance == -1)
+            return -1;
+        return create_time_ + last_check_relative_tick_ + distance + 1;
+    }
+
+    /* Count of pending events */
+    long size() const
+    {
+        return elem_cnt_;
+    }
+
+private:
+    static void list_init(Link *head)
+    {
+        head->prev = head;
+        head->next = head;
+    }
+
+    static bool list_empty(const Link *head)
+    {
+        return head->next == head;
+    }
+
+    static void list_push_back(Link *head, Link *link)
+    {
+        link->prev = head->prev;
+        link->next = head;
+        head->prev->next = link;
+        head->prev = link;
+    }
+
+    static void list_remove(Link *link)
+    {
+        link->prev->next = link->next;
+        link->next->prev = link->prev;
+    }
+
+    /* link is the first member of a node */
+    static Node *node_of(Link *link)
+    {
+        return reinterpret_cast<Node *>(link);
+    }
+
+    static unsigned long spoke_of(unsigned long n)
+    {
+        return POW2 ? (n & (WheelSize - 1)) : (n % WheelSize);
+    }
+
+    static unsigned long rotation_of(unsigned long distance)
+    {
+        return POW2 ? (distance >> SHIFT) : (distance / WheelSize);
+    }
+
+    void bitmap_set(long bit)
+    {
+        bitmap_[bit / WORD_BITS] |= 1UL << (bit % WORD_BITS);
+    }
+
+    void bitmap_clear(long bit)
+    {
+        bitmap_[bit / WORD_BITS] &= ~(1UL << (bit % WORD_BITS));
+    }
+
+    /* first set bit in [start, WheelSize), -1 if there is none */
+    long bitmap_find_next(long start) const
+    {
+        long i = start / WORD_BITS;
+        unsigned long word;
+
+        if(start >= WheelSize)
+            return -1;
+        word = bitmap_[i] & (~0UL << (start % WORD_BITS));
+        while(word == 0)
+        {
+            if(++i >= WORDS)
+                return -1;
+            word = bitmap_[i];
+        }
+        start = i * WORD_BITS + __builtin_ctzl(word);
+        return start < WheelSize ? start : -1;
+    }
+
+    Node *acquire()
+    {
+        if(free_list_ == NULL)
+        {
+            Slab *slab = static_cast<Slab *>(::operator new(sizeof(Slab)));
+            long i;
+            slab->next = slabs_;
+            slabs_ = slab;
+            for(i = SLAB_NODES - 1; i >= 0; i--)
+            {
+                slab->nodes[i].gen = 0;
+                slab->nodes[i].link.next = free_list_;
+                free_list_ = &(slab->nodes[i].link);
+            }
+        }
+        Node *node = node_of(free_list_);
+        free_list_ = free_list_->next;
+        return node;
+    }
+
+    void release(Node *node)
+    {
+        node->event().~Event();
+        node->status = NOT_IN_TIMER;
+        node->gen ++;
+        node->link.next = free_list_;
+        free_list_ = &(node->link);
+    }
+
+    void destroy_list(Link *head)
+    {
+        while(!list_empty(head))
+        {
+            Node *node = node_of(head->next);
+            list_remove(&(node->link));
+            release(node);
+        }
+    }
+
+    /* File node by its expire relative to the last checked tick, see wheel_insert */
+    void insert(Node *node)
+    {
+        long distance = node->expire - create_time_ - last_check_relative_tick_;
+        if(distance < 0)
+        {
+            distance = 0;
+        }
+        node->rotation_cnt = rotation_of(distance);
+        node->cursor = spoke_of(spoke_index_ + spoke_of(distance));
+        list_push_back(&spokes_[node->cursor], &(node->link));
+        bitmap_set(node->cursor);
+    }
+
+    /* Unlink a node in the wheel or the expired list */
+    void remove(Node *node)
+    {
+        list_remove(&(node->link));
+        if(node->cursor != EXPIRED_CURSOR && list_empty(&spokes_[node->cursor]))
+        {
+            bitmap_clear(node->cursor);
+        }
+        node->status = NOT_IN_TIMER;
+        elem_cnt_ --;
+    }
+
+    void reset(Node *node, long current_time, long timeout)
+    {
+        if(node->status == IN_TIMER)
+        {
+            remove(node);
+        }
+
+        /* an expire before the timer's current time is due at next check */
+        long timer_curr_time = create_time_ + last_check_relative_tick_;
+        if(timer_curr_time >= current_time + timeout)
+        {
+            timeout = 1;
+            current_time = timer_curr_time;
+        }
+        node->expire = current_time + timeout;
+        insert(node);
+        node->status = IN_TIMER;
+        elem_cnt_ ++;
+    }
+
+    long next_distance() const
+    {
+        long spoke = bitmap_find_next(spoke_index_);
+        if(spoke != -1)
+        {
+            return spoke - spoke_index_;
+        }
+        spoke = bitmap_find_next(0);
+        if(spoke != -1)
+        {
+            return WheelSize + spoke - spoke_index_;
+        }
+        return -1;
+    }
+
+    void skip(long tickcnt)
+    {
+        last_check_relative_tick_ += tickcnt;
+        spoke_index_ = spoke_of(spoke_index_ + tickcnt);
+    }
+
+    /* Pass spoke passes times at once, moving due nodes to the expired list */
+    long sweep_spoke(long spoke, long passes)
+    {
+        Link *head = &spokes_[spoke];
+        Link *link = head->next, *next;
+        long moved = 0;
+
+        while(link != head)
+        {
+            Node *node = node_of(link);
+            next = link->next;
+            if(node->rotation_cnt < passes)
+            {
+                list_remove(link);
+                node->cursor = EXPIRED_CURSOR;
+                list_push_back(&expired_, link);
+                moved ++;
+            }
+            else
+            {
+                node->rotation_cnt -= passes;
+            }
+            link = next;
+        }
+        if(list_empty(head))
+        {
+            bitmap_clear(spoke);
+        }
+        return moved;
+    }
+
+    long gather_expired(long current_time, long want)
+    {
+        long moved = 0, spoke = -1;
+
+        if(create_time_ == -1)
+            return 0;
+
+        long tickcnt = current_time - create_time_ - last_check_relative_tick_;
+        if(tickcnt >= WheelSize)
+        {
+            /* after a long gap every spoke is passed at least once, see wheel_fast_forward */
+            while((spoke = bitmap_find_next(spoke + 1)) != -1)
+            {
+                long distance = spoke_of(spoke - spoke_index_ + WheelSize);
+                moved += sweep_spoke(spoke, (tickcnt - 1 - distance) / WheelSize + 1);
+            }
+            skip(tickcnt);
+            return moved;
+        }
+
+        /* the rest ticks are checked next time when want is reached */
+        while(tickcnt > 0 && moved < want)
+        {
+            /* jump over empty spokes */
+            long distance = next_distance();
+            if(distance == -1 || distance >= tickcnt)
+            {
+                skip(tickcnt);
+                break;
+            }
+            skip(distance);
+            moved += sweep_spoke(spoke_index_, 1);
+            skip(1);
+            tickcnt -= distance + 1;
+        }
+        return moved;
+    }
+
+    long fire_expired(long max_cb_times)
+    {
+        long cb_cnt = 0;
+
+        while(cb_cnt < max_cb_times && !list_empty(&expired_))
+        {
+            Node *node = node_of(expired_.next);
+            remove(node);
+            callback_(node->event());
+            cb_cnt ++;
+
+            /* the callback may have reset it */
+            if(node->status == NOT_IN_TIMER)
+            {
+                release(node);
+            }
+        }
+        return cb_cnt;
+    }
+
+    Callback callback_;
+    long create_time_;
+    long last_check_relative_tick_;
+    long spoke_index_;
+    long elem_cnt_;
+    Link *free_list_;                   /* released nodes, linked by link.next */
+    Slab *slabs_;
+    Link expired_;                      /* due nodes in spoke order */
+    Link spokes_[WheelSize];
+    unsigned long bitmap_[WORDS];       /* spokes occupancy */
+};
+
+}
+
+#endif	//_MESA_TIMER_HPP_INCLUDE_
@@ -0,0 +1,128 @@
+/************************************************
+*				MESA timer driver API
+* Drive a MESA timer by a Linux timerfd, armed to
+* the timer's next deadline.
+************************************************/
+
+#ifndef	_MESA_TIMER_DRIVER_INCLUDE_
+#define	_MESA_TIMER_DRIVER_INCLUDE_
+
+#include <pthread.h>
+#include "MESA_timer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Timer driver's handler */
+typedef struct{
+}MESA_timer_driver_t;
+
+
+/**
+ * Description:
+ *     Create a driver of timer. Time of the driven timer is CLOCK_MONOTONIC
+ *     in ticks of tick_nsec nanoseconds: events MUST be added with
+ *     current_time from MESA_timer_driver_now. The driver owns a timerfd
+ *     which becomes readable when the earliest event is due, it can be
+ *     polled in user's epoll set with MESA_timer_driver_dispatch called when
+ *     readable, or be run on a thread by MESA_timer_driver_run.
+ * Params:
+ *     timer: The timer returned by MESA_timer_create function.
+ *     tick_nsec: Length of a tick in nanoseconds, e.g. 1000000 for 1ms.
+ *     max_cb_times: max_cb_times of every MESA_timer_check by the driver.
+ *     lock: NULL if timer is only used by the thread dispatching. Otherwise
+ *           the driver holds lock while checking timer, callbacks included,
+ *           and other threads MUST hold it to use timer.
+ * Return:
+ *     On success, return a driver, else return NULL
+ **/
+MESA_timer_driver_t *MESA_timer_driver_create(MESA_timer_t *timer, long tick_nsec, long max_cb_times, pthread_mutex_t *lock);
+
+
+/**
+ * Description:
+ *     Get the driver's timerfd to poll for EPOLLIN/POLLIN.
+ * Params:
+ *     driver: Driver returned by MESA_timer_driver_create.
+ * Return:
+ *     Return the file descriptor.
+ **/
+int MESA_timer_driver_fd(MESA_timer_driver_t *driver);
+
+
+/**
+ * Description:
+ *     Get current time of the driven timer, in ticks of CLOCK_MONOTONIC.
+ * Params:
+ *     driver: Driver returned by MESA_timer_driver_create.
+ * Return:
+ *     Return the current time.
+ **/
+long MESA_timer_driver_now(MESA_timer_driver_t *driver);
+
+
+/**
+ * Description:
+ *     Check timer at current time and arm the timerfd to the next deadline.
+ *     Called when the timerfd is readable.
+ * Params:
+ *     driver: Driver returned by MESA_timer_driver_create.
+ * Return:
+ *     Return execute times of callback, -1 when error occurs.
+ **/
+long MESA_timer_driver_dispatch(MESA_timer_driver_t *driver);
+
+
+/**
+ * Description:
+ *     Arm the timerfd earlier if an event added or reset out of callbacks is
+ *     due before the armed deadline. Callbacks need not call it, dispatching
+ *     arms the timerfd after them. Hold lock when it is given to the driver.
+ * Params:
+ *     driver: Driver returned by MESA_timer_driver_create.
+ * Return:
+ *     On success, 0 is returned, else -1 is returned.
+ **/
+int MESA_timer_driver_rearm(MESA_timer_driver_t *driver);
+
+
+/**
+ * Description:
+ *     Dispatch timer on the calling thread until MESA_timer_driver_stop,
+ *     sleeping in between.
+ * Params:
+ *     driver: Driver returned by MESA_timer_driver_create.
+ * Return:
+ *     Return 0 when stopped, -1 when error occurs.
+ **/
+int MESA_timer_driver_run(MESA_timer_driver_t *driver);
+
+
+/**
+ * Description:
+ *     Make MESA_timer_driver_run return. It may be called from any thread or
+ *     from callbacks.
+ * Params:
+ *     driver: Driver returned by MESA_timer_driver_create.
+ * Return:
+ *     void
+ **/
+void MESA_timer_driver_stop(MESA_timer_driver_t *driver);
+
+
+/**
+ * Description:
+ *     Destroy the driver, the timer is left to user.
+ * Params:
+ *     driver: The driver we wants to destroy.
+ * Return:
+ *     void
+ **/
+void MESA_timer_driver_destroy(MESA_timer_driver_t *driver);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	//_MESA_TIMER_DRIVER_INCLUDE_
@@ -0,0 +1,99 @@
+/************************************************
+*				MESA timer executor API
+* Run callbacks of expired events on a pool of
+* threads, so that a burst of slow callbacks does
+* not stall the thread checking the timer.
+************************************************/
+
+#ifndef	_MESA_TIMER_EXECUTOR_INCLUDE_
+#define	_MESA_TIMER_EXECUTOR_INCLUDE_
+
+#include "MESA_timer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Executor's handler */
+typedef struct{
+}MESA_timer_executor_t;
+
+
+/**
+ * Description:
+ *     Create an executor of thread_cnt threads sharing a lock-free queue of
+ *     queue_size events. One executor may serve several timers, each checked
+ *     by its own thread.
+ * Params:
+ *     thread_cnt: Threads running callbacks, It MUST > 0.
+ *     queue_size: Events queued at most, rounded up to a power of 2.
+ * Return:
+ *     On success, return an executor, else return NULL
+ **/
+MESA_timer_executor_t *MESA_timer_executor_create(int thread_cnt, long queue_size);
+
+
+/**
+ * Description:
+ *     Check timer like MESA_timer_check, but only unlink expired events and
+ *     queue them to the executor's threads, which call timeout_cb and free_cb.
+ *     An event stays in flight until its callbacks return: MESA_timer_del
+ *     and MESA_timer_reset of it return -1 meanwhile, except that deleting a
+ *     periodic event stops it, and its element is reused or filed again only
+ *     after that. Events beyond the free room of the queue stay
+ *     due in timer for the next check; an event that finds the queue
+ *     filled up by other checking threads is run by the caller, and the
+ *     check stops there. Callbacks run concurrently and MUST
+ *     NOT use timer, which belongs to the checking thread.
+ * Params:
+ *     executor: Executor returned by MESA_timer_executor_create.
+ *     timer: The timer to check, its nodes of MESA_timer_add_node are still
+ *            called back by the checking thread.
+ *     current_time: The same as MESA_timer_check.
+ *     max_cnt: Max count of events to queue.
+ * Return:
+ *     Return the count of events queued or run by the caller, -1 when error
+ *     occurs.
+ **/
+long MESA_timer_executor_check(MESA_timer_executor_t *executor, MESA_timer_t *timer, long current_time, long max_cnt);
+
+
+/**
+ * Description:
+ *     Get the count of events queued or running.
+ * Params:
+ *     executor: Executor returned by MESA_timer_executor_create.
+ * Return:
+ *     Return the count.
+ **/
+long MESA_timer_executor_pending(MESA_timer_executor_t *executor);
+
+
+/**
+ * Description:
+ *     Wait until every queued event's callbacks have returned, e.g. before
+ *     destroying a timer served by the executor.
+ * Params:
+ *     executor: Executor returned by MESA_timer_executor_create.
+ * Return:
+ *     void
+ **/
+void MESA_timer_executor_wait(MESA_timer_executor_t *executor);
+
+
+/**
+ * Description:
+ *     Run the queued events, then stop the threads and destroy the executor.
+ *     Timers are left to user.
+ * Params:
+ *     executor: The executor we wants to destroy.
+ * Return:
+ *     void
+ **/
+void MESA_timer_executor_destroy(MESA_timer_executor_t *executor);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	//_MESA_TIMER_EXECUTOR_INCLUDE_
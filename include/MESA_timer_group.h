@@ -0,0 +1,111 @@
+/************************************************
+*				MESA timer group API
+* A group of timers, one shard per worker thread.
+************************************************/
+
+#ifndef	_MESA_TIMER_GROUP_INCLUDE_
+#define	_MESA_TIMER_GROUP_INCLUDE_
+
+#include "MESA_timer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Timer group's handler */
+typedef struct{
+}MESA_timer_group_t;
+
+
+/**
+ * Description:
+ *     Create a group of shard_cnt timers, each of them is created by opt.
+ *     Shard i is owned by worker i: only worker i may add, delete or reset
+ *     events on it, through the MESA_timer_* functions on the timer returned
+ *     by MESA_timer_group_shard, which take no lock.
+ * Params:
+ *     shard_cnt: Count of shards, normally the count of worker threads.
+ *     opt: Options of every shard, see MESA_timer_create_ex.
+ * Return:
+ *     On success, return a timer group, else return NULL
+ **/
+MESA_timer_group_t *MESA_timer_group_create(int shard_cnt, const MESA_timer_opt_t *opt);
+
+
+/**
+ * Description:
+ *     Get the timer of a shard. It MUST only be used by the shard's owner.
+ * Params:
+ *     group: Timer group returned by MESA_timer_group_create.
+ *     shard: Index of the shard, from 0 to shard_cnt - 1.
+ * Return:
+ *     Return the shard's timer.
+ **/
+MESA_timer_t *MESA_timer_group_shard(MESA_timer_group_t *group, int shard);
+
+
+/**
+ * Description:
+ *     Called by the owner of shard like MESA_timer_check. Expired events of
+ *     the shard are moved into the shard's backlog, and then callbacks of the
+ *     backlog are invoked in batches. When the shard's backlog is empty, the
+ *     worker steals batches from the backlog of the most loaded shard, so an
+ *     idle worker helps a worker with many expired events.
+ *     Once an event is moved into a backlog it is no longer in its shard:
+ *     the index is invalid and the event cannot be deleted or reset, that is
+ *     every event whose expire <= current_time when this returns. Its
+ *     callback may run on another worker, followed by its free_cb as
+ *     MESA_timer_check does; a callback which wants the event again adds it
+ *     to the shard returned by MESA_timer_group_self. Periodic events are
+ *     filed again in their shard and have no free_cb here.
+ * Params:
+ *     group: Timer group returned by MESA_timer_group_create.
+ *     shard: Index of the caller's shard.
+ *     current_time: The same as MESA_timer_check.
+ *     max_cb_times: Max times to call callback function, stolen ones included.
+ * Return:
+ *     Return execute times of callback, -1 when error occurs.
+ **/
+long MESA_timer_group_check(MESA_timer_group_t *group, int shard, long current_time, long max_cb_times);
+
+
+/**
+ * Description:
+ *     Get the shard of the calling worker in a callback invoked by
+ *     MESA_timer_group_check.
+ * Return:
+ *     Return the shard passed to the running MESA_timer_group_check, -1 when
+ *     not called from a callback.
+ **/
+int MESA_timer_group_self(void);
+
+
+/**
+ * Description:
+ *     Get the count of expired events waiting for callback in a shard. It may
+ *     be called by any worker, the count is a snapshot.
+ * Params:
+ *     group: Timer group returned by MESA_timer_group_create.
+ *     shard: Index of the shard.
+ * Return:
+ *     Return the count of the shard's backlog.
+ **/
+long MESA_timer_group_backlog(MESA_timer_group_t *group, int shard);
+
+
+/**
+ * Description:
+ *     Destroy the group after all workers stopped, free_cb is called for every
+ *     event in shards and backlogs.
+ * Params:
+ *     group: The timer group we wants to destroy.
+ * Return:
+ *     void
+ **/
+void MESA_timer_group_destroy(MESA_timer_group_t *group);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	//_MESA_TIMER_GROUP_INCLUDE_
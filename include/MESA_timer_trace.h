@@ -0,0 +1,147 @@
+/************************************************
+*				MESA timer trace API
+* Record adds, deletes, resets and checks of a
+* timer into a ring file of fixed size records,
+* which mesa_timer_replay plays against any timer
+* type offline.
+************************************************/
+
+#ifndef	_MESA_TIMER_TRACE_INCLUDE_
+#define	_MESA_TIMER_TRACE_INCLUDE_
+
+#include <stdint.h>
+#include "MESA_timer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MESA_TIMER_TRACE_MAGIC 0x5254544d      /* "MTTR" */
+#define MESA_TIMER_TRACE_VERSION 2
+
+/* Operations of records */
+#define MESA_TIMER_TRACE_START 0        /* trace attached, arg: timer type, arg2: wheel size or
+                                         * class count, id: slack_pct, flags: MESA_TIMER_TRACE_START_* */
+#define MESA_TIMER_TRACE_ADD 1          /* arg: timeout, arg2: slack, -1 for the timer's slack_pct */
+#define MESA_TIMER_TRACE_ADD_PERIODIC 2 /* arg: first, arg2: interval, flags: MESA_TIMER_PERIODIC_* */
+#define MESA_TIMER_TRACE_DEL 3          /* time is -1 */
+#define MESA_TIMER_TRACE_RESET 4        /* arg: timeout, arg2: slack, -1 for the timer's slack_pct */
+#define MESA_TIMER_TRACE_CHECK 5        /* arg: max count, flags: MESA_TIMER_TRACE_CHECK_* */
+
+/* flags of MESA_TIMER_TRACE_START */
+#define MESA_TIMER_TRACE_START_LAZY_RESET 0x1   /* the timer has lazy_reset */
+
+/* flags of MESA_TIMER_TRACE_CHECK */
+#define MESA_TIMER_TRACE_CHECK_CB 0         /* MESA_timer_check */
+#define MESA_TIMER_TRACE_CHECK_COLLECT 1    /* MESA_timer_check_collect */
+#define MESA_TIMER_TRACE_CHECK_INFLIGHT 2   /* MESA_timer_check_inflight */
+
+
+/**
+ * Header at the start of a trace file, followed by ring_records records.
+ * When written > ring_records the ring has wrapped, and the oldest record
+ * is at written % ring_records. Integers are in host byte order. The timer's
+ * options are those of the last MESA_TIMER_TRACE_START.
+ **/
+typedef struct _MESA_timer_trace_header_t{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;               /* sizeof(MESA_timer_trace_record_t) */
+    uint64_t ring_records;              /* records the ring holds */
+    uint64_t written;                   /* records written since the file was opened */
+    int64_t timer_type;                 /* -1 before a MESA_TIMER_TRACE_START */
+    int64_t wheel_size;                 /* wheel size, or class count of TM_TYPE_MQUEUE */
+    int64_t slack_pct;
+    int64_t lazy_reset;
+    uint64_t reserved[1];
+}MESA_timer_trace_header_t;
+
+
+/**
+ * A recorded call. id is the element's index in the timer, the same as
+ * the index part of a MESA_timer_handle_t, which is reused after the
+ * element times out or is deleted, except in MESA_TIMER_TRACE_START. Nodes of MESA_timer_add_node are not
+ * recorded.
+ **/
+typedef struct _MESA_timer_trace_record_t{
+    int64_t time;                       /* current_time of the call */
+    int64_t arg;
+    int64_t arg2;
+    uint32_t id;
+    uint8_t op;                         /* MESA_TIMER_TRACE_* */
+    uint8_t flags;
+    uint16_t reserved;
+}MESA_timer_trace_record_t;
+
+
+/* Trace's handler */
+typedef struct{
+}MESA_timer_trace_t;
+
+
+/**
+ * Description:
+ *     Create a trace file of a ring of ring_records records, an existing
+ *     file is truncated. Records are buffered in memory and written in
+ *     batches.
+ * Params:
+ *     path: Path of the trace file.
+ *     ring_records: Records kept in the file, older ones are overwritten.
+ *                   It MUST > 0
+ * Return:
+ *     On success, return a trace, else return NULL
+ **/
+MESA_timer_trace_t *MESA_timer_trace_open(const char *path, long ring_records);
+
+
+/**
+ * Description:
+ *     Append a record to trace, called by timers the trace is attached to.
+ * Params:
+ *     trace: Trace returned by MESA_timer_trace_open.
+ *     record: The record to append.
+ * Return:
+ *     void
+ **/
+void MESA_timer_trace_write(MESA_timer_trace_t *trace, const MESA_timer_trace_record_t *record);
+
+
+/**
+ * Description:
+ *     Write buffered records and the header to the file.
+ * Params:
+ *     trace: Trace returned by MESA_timer_trace_open.
+ * Return:
+ *     On success 0 is returned, -1 if any write of trace has failed.
+ **/
+int MESA_timer_trace_flush(MESA_timer_trace_t *trace);
+
+
+/**
+ * Description:
+ *     Flush and close trace. Detach it from its timer first.
+ * Params:
+ *     trace: The trace we wants to close.
+ * Return:
+ *     On success 0 is returned, -1 if any write of trace has failed.
+ **/
+int MESA_timer_trace_close(MESA_timer_trace_t *trace);
+
+
+/**
+ * Description:
+ *     Record every add, delete, reset and check of timer into trace, from
+ *     the calling thread of timer. A trace serves one timer.
+ * Params:
+ *     timer: The timer to record.
+ *     trace: Trace returned by MESA_timer_trace_open, NULL stops recording.
+ * Return:
+ *     void
+ **/
+void MESA_timer_set_trace(MESA_timer_t *timer, MESA_timer_trace_t *trace);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	//_MESA_TIMER_TRACE_INCLUDE_
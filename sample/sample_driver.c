@@ -0,0 +1,62 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<pthread.h>
+#include"MESA_timer_driver.h"
+
+/* ticks of 1ms */
+#define TICK_NSEC 1000000
+
+typedef struct event_t{
+    int id;
+    long expire;
+}event_t;
+
+static MESA_timer_driver_t *driver;
+static int fired = 0;
+
+void event_cb(void *event)
+{
+    event_t *_event = (event_t *)event;
+    printf("event %d timeout, late %ld ms\n", _event->id, MESA_timer_driver_now(driver) - _event->expire);
+    if(++fired == 10)
+    {
+        MESA_timer_driver_stop(driver);
+    }
+    return;
+}
+
+void *driver_thread(void *arg)
+{
+    MESA_timer_driver_run(driver);
+    return NULL;
+}
+
+int main()
+{
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    MESA_timer_t *timer = MESA_timer_create(0, TM_TYPE_HWHEEL);
+    MESA_timer_index_t *index;
+    event_t events[10];
+    pthread_t thread;
+    int i;
+
+    driver = MESA_timer_driver_create(timer, TICK_NSEC, 10000, &lock);
+    pthread_create(&thread, NULL, driver_thread, NULL);
+
+    /* add events from this thread while the driver sleeps, later ones first */
+    for(i = 9; i >= 0; i--)
+    {
+        pthread_mutex_lock(&lock);
+        long now = MESA_timer_driver_now(driver);
+        events[i].id = i;
+        events[i].expire = now + 100 * (i + 1);
+        MESA_timer_add(timer, now, 100 * (i + 1), event_cb, &events[i], NULL, &index);
+        MESA_timer_driver_rearm(driver);
+        pthread_mutex_unlock(&lock);
+    }
+
+    pthread_join(thread, NULL);
+    MESA_timer_driver_destroy(driver);
+    MESA_timer_destroy(timer);
+    return 0;
+}
@@ -5,11 +5,25 @@
 * last modify:2015-8-19
 ************************************************/
 #include "MESA_timer.h"
+#include "MESA_timer_trace.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include <assert.h>
+#include <time.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/queue.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#include <x86intrin.h>
+#include <cpuid.h>
+#endif
 
 const char *MESA_timer_version_VERSION_20150918 = "MESA_timer_version_VERSION_20150918";
 
@@ -21,23 +35,149 @@ const char *MESA_timer_version_VERSION_20150918 = "MESA_timer_version_VERSION_20
 #define NOT_IN_TIMER 0
 #endif
 
+/* handed out by MESA_timer_check_inflight, until MESA_timer_inflight_done is drained */
+#define IN_FLIGHT 2
+
+/* cursor of an element which has expired but whose callback is deferred */
+#define EXPIRED_CURSOR (-1)
+
+/* the element is a MESA_timer_node_t owned by user, not by the node pool */
+#define ELEM_FLAG_NODE 0x1
+
+/* the element is filed in spokes of this epoch of a resized time wheel */
+#define ELEM_FLAG_EPOCH 0x2
+
+/* the element is re-filed after its callback, see MESA_timer_add_periodic */
+#define ELEM_FLAG_PERIODIC 0x4
+#define ELEM_FLAG_DRIFT_FREE 0x8
+#define ELEM_FLAG_SKIP_MISSED 0x10
+
+/* a periodic element deleted while its callback runs, it is not re-filed */
+#define ELEM_FLAG_STOPPED 0x20
+
+/**
+ * Hierarchical time wheel geometry: level 0 has 256 slots of one tick,
+ * each upper level has 64 slots, every slot of level n spans a whole
+ * revolution of level n-1. All slots live in one flat array, so a slot
+ * index is a valid cursor and level n (n >= 1) owns exactly one 64-bit
+ * word of the occupancy bitmap.
+ **/
+#define HWHEEL_L0_BITS 8
+#define HWHEEL_LN_BITS 6
+#define HWHEEL_LEVELS 6
+#define HWHEEL_L0_SIZE (1 << HWHEEL_L0_BITS)
+#define HWHEEL_LN_SIZE (1 << HWHEEL_LN_BITS)
+#define HWHEEL_L0_MASK (HWHEEL_L0_SIZE - 1)
+#define HWHEEL_LN_MASK (HWHEEL_LN_SIZE - 1)
+#define HWHEEL_SLOTS (HWHEEL_L0_SIZE + HWHEEL_LN_SIZE * (HWHEEL_LEVELS - 1))
+#define HWHEEL_MAX_TICKS ((1L << (HWHEEL_L0_BITS + HWHEEL_LN_BITS * (HWHEEL_LEVELS - 1))) - 1)
+
+/* elements per slab of the node pool when not given by MESA_timer_create_ex */
+#define DEFAULT_SLAB_ELEMS 256
+
+/* ENTRYSs fired early at once when timer is full */
+#define DEFAULT_EVICT_BATCH 64
+
+/* ENTRYSs of later rotations a wheel eviction passes over per one it takes */
+#define EVICT_SCAN_FACTOR 8
+
+/* ENTRYSs moved from old spokes of a resized time wheel per check, besides due ones */
+#define RESIZE_MIGRATE_ELEMS 1024
+
+/* timeouts sampled between two auto resizings, and wheel sizes tuned to */
+#define AUTO_RESIZE_SAMPLES 65536
+#define AUTO_RESIZE_PCT 90
+#define AUTO_RESIZE_MIN 64
+
+/* the first TSC rate is measured over this long, then refined every TSC_RECALIBRATE_NS */
+#define TSC_CALIBRATE_NS 2000000L
+#define TSC_RECALIBRATE_NS 1000000000L
+
+#define DEFAULT_CLOCK_RES_NS 1000000L
+
+#define SNAPSHOT_MAGIC "MESATMR"
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_ALIGN(len) (((len) + 7) & ~7L)
+#define SNAPSHOT_BUF_INIT 256
+
+/**
+ * MESA_timer_handle_t: the low HANDLE_INDEX_BITS bits are the element's index
+ * in the node pool, the high bits its generation, which is never 0. Build
+ * with MESA_TIMER_HANDLE_INDEX_BITS from 16 to 31 to trade generations for
+ * elements, 24 by default.
+ **/
+#ifdef MESA_TIMER_HANDLE_INDEX_BITS
+#define HANDLE_INDEX_BITS MESA_TIMER_HANDLE_INDEX_BITS
+#else
+#define HANDLE_INDEX_BITS 24
+#endif
+#define HANDLE_INDEX_MASK ((1U << HANDLE_INDEX_BITS) - 1)
+#define HANDLE_GEN_MASK ((1U << (32 - HANDLE_INDEX_BITS)) - 1)
+#define HANDLE_MAX_ELEMS (1L << HANDLE_INDEX_BITS)
+
+/**
+ * 4-ary heap: 16-byte entries are stored 3 slots after a cache line aligned
+ * base, so the four children 4p+1..4p+4 of position p share one line.
+ **/
+#define HEAP_ARITY 4
+#define HEAP_PAD 3
+#define HEAP_ALIGN 64
+#define HEAP_INIT_CAPACITY 64
+
+/* classes of distinct timeouts in a multi-class queue */
+#define MQUEUE_DEFAULT_CLASSES 16
+#define MQUEUE_MAX_CLASSES 64
+
+#define PREFETCH(addr) __builtin_prefetch(addr)
+
+/* duration of one callback in STATS_CB_SAMPLE is measured, a power of 2 */
+#define STATS_CB_SAMPLE 16
+
+#ifndef MESA_TIMER_NO_STATS
+#define STATS_ADD(_timer, field, n) ((_timer)->stats.field += (n))
+#define STATS_HIST(_timer, hist, value) ((_timer)->stats.hist[stats_bucket(value)] ++)
+#else
+#define STATS_ADD(_timer, field, n) ((void)0)
+#define STATS_HIST(_timer, hist, value) ((void)0)
+#endif
+
+/* record a call into the attached trace, see MESA_timer_set_trace */
+#define TRACE(_timer, op, id, time, arg, arg2, flags) \
+    do{ if(__builtin_expect((_timer)->trace != NULL, 0)) timer_trace(_timer, op, id, time, arg, arg2, flags); }while(0)
+
+/* initial capacity of a spoke of the array backed time wheel */
+#define SWHEEL_SPOKE_INIT 8
+
+#define BITMAP_WORD_BITS 64
+#define BITMAP_WORDS(nbits) (((nbits) + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS)
+
 /**
  * A timer element's structure
  **/
 typedef struct _timer_elem_t{
     long expire;                 /* event's absolute expire */
-    int rotation_cnt;            /* used in time wheel */
+    int rotation_cnt;            /* used in time wheel, position in its spoke's arrays in TM_TYPE_SWHEEL */
     int cursor;                  /* use in time wheel, representing the spoke index */
     timeout_cb_t timeout_cb;      /* event's callback function */
 
     void *event;                 /* event */
     event_free_cb_t free_cb;     /* event free callback function */
 
-    int status;                  /* whether the elem is in timer: IN_TIMER or NOT_IN_TIMER */
+    unsigned char status;        /* whether the elem is in timer: IN_TIMER or NOT_IN_TIMER */
+    unsigned char flags;         /* ELEM_FLAG_* */
+    unsigned short gen;          /* generation in handles, changed when the elem is freed */
+    unsigned int id;             /* index in the node pool, unused by MESA_timer_node_t */
     TAILQ_ENTRY(_timer_elem_t) ENTRYS;
 }timer_elem_t;
 
 
+/* generations of handles MUST fit timer_elem_t.gen */
+typedef char timer_handle_bits_check[HANDLE_INDEX_BITS >= 16 && HANDLE_INDEX_BITS < 32 ? 1 : -1];
+
+/* MESA_timer_node_t MUST be able to hold a timer element */
+typedef char timer_node_size_check[sizeof(MESA_timer_node_t) >= sizeof(timer_elem_t) ? 1 : -1];
+
+
 /**
  * DouleLinkedList: TQ
  **/
@@ -62,507 +202,4368 @@ typedef struct _timer_wheel_t{
     long spoke_index;                           /* current spoke index*/
     long last_check_relative_tick;              /* last check's relative ticks */
     struct TQ *spokes;       /* queues array */
+    unsigned long *bitmap;                      /* spokes occupancy */
+    int epoch;                                  /* ELEM_FLAG_EPOCH of ENTRYSs in spokes, flipped by resizing */
+    struct TQ *old_spokes;                      /* spokes before resizing, NULL when all are moved */
+    unsigned long *old_bitmap;                  /* old spokes occupancy */
+    long old_size;                              /* size of old spokes */
+    long old_index;                             /* spoke index when resized */
+    long old_base;                              /* time checked to when resized */
+    long migrated;                              /* old spokes moved, from old_index on */
 }timer_wheel_t;
 
 
+/**
+ * Spoke of the array backed time wheel: rotations and elements are parallel
+ * arrays, so that rotations are scanned without touching elements.
+ **/
+typedef struct _timer_swheel_spoke_t{
+    int *rotations;                             /* rotations to go of each element */
+    timer_elem_t **elems;                       /* elements, elem->rotation_cnt is the position */
+    int cnt;                                    /* elements in spoke */
+    int capacity;                               /* size of arrays */
+}timer_swheel_spoke_t;
+
+/**
+ * Subtract passes from every rotation of a spoke, and set the bit of each
+ * element whose rotation runs out in due.
+ **/
+typedef void (*swheel_scan_t)(int *rotations, long cnt, int passes, unsigned long *due);
+
+/**
+ * Array backed time wheel structure
+ **/
+typedef struct _timer_swheel_t{
+    timer_wheel_t wheel;                        /* clock and spokes occupancy, wheel.spokes is unused */
+    timer_swheel_spoke_t *spokes;               /* spokes array */
+    unsigned long *due;                         /* due bits of the spoke being swept */
+    long due_words;                             /* size of due, enough for the largest spoke */
+    swheel_scan_t scan;                         /* the fastest scan of this CPU */
+}timer_swheel_t;
+
+
+/**
+ * Hierarchical time wheel structure
+ **/
+typedef struct _timer_hwheel_t{
+    long current;                                           /* next tick to process, -1 before the first add */
+    unsigned long bitmap[BITMAP_WORDS(HWHEEL_SLOTS)];       /* slots occupancy */
+    struct TQ *slots;                                       /* HWHEEL_SLOTS queues, level 0 first */
+}timer_hwheel_t;
+
+
+/**
+ * Heap entry, the expire is copied here to compare without touching elements
+ **/
+typedef struct _timer_heap_entry_t{
+    long expire;
+    timer_elem_t *elem;
+}timer_heap_entry_t;
+
+/**
+ * Time heap structure
+ **/
+typedef struct _timer_heap_t{
+    timer_heap_entry_t *entries;    /* entries[0] is the earliest, elem->cursor is its position */
+    long size;                      /* entries in use */
+    long capacity;                  /* entries allocated */
+}timer_heap_t;
+
+
+/**
+ * Multi-class time queue structure: one FIFO queue per distinct timeout,
+ * elem->cursor is the class of the element.
+ **/
+typedef struct _timer_mqueue_t{
+    int class_cnt;                  /* classes in use */
+    int class_max;                  /* at most class_max distinct timeouts */
+    int last_class;                 /* class of the last add, looked up first */
+    int min_class;                  /* class with the earliest head, -1 when all are empty */
+    long *timeouts;                 /* timeout of each class */
+    long *head_expire;              /* expire of each class's head, LONG_MAX when empty */
+    struct TQ *queues;              /* queue of each class */
+}timer_mqueue_t;
+
+
+/**
+ * Slab pool of timer elements. Slabs are never returned before the timer
+ * is destroyed; freed elements are chained by their ENTRYS.tqe_next.
+ **/
+typedef struct _timer_pool_t{
+    timer_elem_t *free_list;                    /* freed elements */
+    timer_elem_t **slabs;                       /* slab directory */
+    long slab_cnt;                              /* slabs allocated */
+    long slab_cap;                              /* capacity of slab directory */
+    long slab_elems;                            /* elements per slab, a power of 2 */
+    int slab_shift;                             /* log2 of slab_elems */
+    long bump_slab;                             /* slab where never used elements start */
+    long bump_off;                              /* first never used element in bump_slab */
+    long free_cnt;                              /* elements in free_list */
+    long **intervals;                           /* interval of periodic elements, per slab, allocated on first use */
+}timer_pool_t;
+
+
+/**
+ * Clock of the *_now functions, in ticks of res nanoseconds of
+ * CLOCK_MONOTONIC. It is read when checking and cached in now. A TSC clock
+ * converts cycles since tsc_base by ns_per_cycle, which is measured again
+ * against CLOCK_MONOTONIC over the whole time since tsc_anchor every
+ * TSC_RECALIBRATE_NS, and slews to it so that time never jumps.
+ **/
+typedef struct _timer_clock_t{
+    int mode;                                   /* MESA_TIMER_CLOCK_* */
+    long res;                                   /* nanoseconds of a tick */
+    long now;                                   /* time of the last refresh, in ticks */
+    uint64_t tsc_anchor;                        /* TSC when calibration began */
+    long long mono_anchor;                      /* CLOCK_MONOTONIC when calibration began */
+    uint64_t tsc_base;                          /* TSC at base_ns */
+    double base_ns;                             /* time at tsc_base */
+    double ns_per_cycle;
+    uint64_t tsc_calibrate;                     /* TSC of next calibration */
+}timer_clock_t;
+
+
 /**
  * Timer's structure
  **/
 typedef struct _MESA_timer_inner_t{
-    int type;                           /* type of timer: TM_TYPE_QUEUE and TM_TYPE_WHEEL */
-    union{                              /* time queue or time wheel */
+    int type;                           /* type of timer: TM_TYPE_QUEUE, TM_TYPE_WHEEL, ... */
+    union{                              /* time queue, time wheel or time heap */
         timer_queue_t timer_queue;
         timer_wheel_t timer_wheel;
+        timer_hwheel_t timer_hwheel;
+        timer_heap_t timer_heap;
+        timer_mqueue_t timer_mqueue;
+        timer_swheel_t timer_swheel;
     };
+    struct TQ expired;                  /* expired ENTRYS whose callbacks are deferred by max_cb_times */
+    timer_pool_t pool;                  /* timer ENTRYS allocator */
     long elem_cnt;                      /* timer ENTRYSs' count */
-    long mem_ocupy;                     /* memory occupation */
+    int lazy_reset;                     /* reset only stores a later expire, see MESA_timer_opt_t */
+    int slack_pct;                      /* slack of add and reset in percent of timeout, see MESA_timer_opt_t */
+    int auto_resize;                    /* TM_TYPE_WHEEL tunes its size by timeouts, see MESA_timer_opt_t */
+    long tune_samples;                  /* timeouts in tune_hist */
+    long tune_hist[MESA_TIMER_HIST_BUCKETS];    /* timeouts since last tuning */
+    int evicting;                       /* callbacks of an eviction are running, adds are not limited */
+    long max_elems;                     /* limit of elem_cnt, 0 if unlimited */
+    long max_bytes;                     /* limit of mem_ocupy, 0 if unlimited */
+    long evict_batch;                   /* ENTRYSs fired at once when a limit is hit */
+    long early_cnt;                     /* ENTRYSs fired before their expire by evictions */
+    timer_clock_t clock;                /* time of the *_now functions */
+    timer_elem_t *done_stack;           /* in flight ENTRYSs done by other threads, lock-free */
+    timer_elem_t *firing;               /* ENTRYS whose callback is running in MESA_timer_check */
+    MESA_timer_trace_t *trace;          /* calls are recorded here, NULL if not */
+#ifndef MESA_TIMER_NO_STATS
+    MESA_timer_stats_t stats;           /* counters and histograms, occupancy_hist is not kept */
+#endif
+    long mem_ocupy;                     /* memory occupation, including slabs */
 }MESA_timer_inner_t;
 
 
 
-MESA_timer_t *MESA_timer_create(long wheel_size, int tm_type)
+/* Histogram bucket of value: 0 for value <= 0, i for [2^(i-1), 2^i) */
+static inline int stats_bucket(long value)
 {
-    MESA_timer_inner_t *timer = NULL;
-    switch(tm_type)
-    {
-        case TM_TYPE_QUEUE:
-        {
-            timer = (MESA_timer_inner_t *)malloc(sizeof(MESA_timer_inner_t));
-            timer->type = TM_TYPE_QUEUE;
-            timer->timer_queue.last_expire_time = -1l;
-            TAILQ_INIT(&(timer->timer_queue.queue));
+    int bucket;
 
-            timer->elem_cnt = 0;
-            timer->mem_ocupy = sizeof(MESA_timer_inner_t);
-            break;
-        }
-        case TM_TYPE_WHEEL:
-        {
-            if(wheel_size <= 0 || wheel_size > MAX_WHEEL_SIZE)
-            {
-                return (MESA_timer_t *)NULL;
-            }
-            timer = (MESA_timer_inner_t *)malloc(sizeof(MESA_timer_inner_t));
-            timer->type = TM_TYPE_WHEEL;
-            timer->timer_wheel.wheel_size = wheel_size;
-            timer->timer_wheel.create_time = -1;
-            timer->timer_wheel.last_check_relative_tick = -1;
-            timer->timer_wheel.spoke_index = 0;
-            timer->timer_wheel.spokes = (struct TQ *)malloc(sizeof(struct TQ) * wheel_size);
+    if(value <= 0)
+        return 0;
+    bucket = BITMAP_WORD_BITS - __builtin_clzl((unsigned long)value);
+    return bucket < MESA_TIMER_HIST_BUCKETS ? bucket : MESA_TIMER_HIST_BUCKETS - 1;
+}
 
-            int i;
-            for(i = 0; i < wheel_size; i++)
-            {
-                TAILQ_INIT(&(timer->timer_wheel.spokes[i]));
-            }
-            timer->elem_cnt = 0;
-            timer->mem_ocupy = sizeof(MESA_timer_inner_t) + sizeof(struct TQ) * wheel_size;
 
-            break;
-        }
-        default:
-            break;
-    }
+static void timer_trace(MESA_timer_inner_t *_timer, int op, unsigned int id, long time, long arg, long arg2, int flags)
+{
+    MESA_timer_trace_record_t record;
 
-    return (MESA_timer_t *)timer;
+    record.time = time;
+    record.arg = arg;
+    record.arg2 = arg2;
+    record.id = id;
+    record.op = op;
+    record.flags = flags;
+    record.reserved = 0;
+    MESA_timer_trace_write(_timer->trace, &record);
 }
 
 
+#ifndef MESA_TIMER_NO_STATS
+static inline long stats_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+#endif
+
 
-void MESA_timer_destroy(MESA_timer_t *timer)
+static void timer_pool_init(MESA_timer_inner_t *_timer, long slab_elems)
 {
-    assert(timer != NULL);
+    timer_pool_t *pool = &(_timer->pool);
+    long n = 1;
+    int shift = 0;
 
-    MESA_timer_inner_t *_timer = (MESA_timer_inner_t *)timer;
-    switch(_timer->type)
+    while(n < slab_elems)
     {
-        case TM_TYPE_QUEUE:
-        {
-            timer_elem_t *tmp_elem = TAILQ_FIRST(&(_timer->timer_queue.queue));
-            timer_elem_t *tmp;
-            while(tmp_elem != NULL)
-            {
-                tmp = TAILQ_NEXT(tmp_elem, ENTRYS);
-                if(tmp_elem->free_cb != NULL)
-                {
-                    tmp_elem->free_cb(tmp_elem->event);
-                }
-                free(tmp_elem);
-                tmp_elem = tmp;
-            }
-            break;
-        }
-        case TM_TYPE_WHEEL:
-        {
-            int i;
-            for(i = 0; i < _timer->timer_wheel.wheel_size; i++)
-            {
-                struct TQ *spoke = &(_timer->timer_wheel.spokes[i]);
-                timer_elem_t *tmp_elem = TAILQ_FIRST(spoke);
-                timer_elem_t *tmp;
-                while(tmp_elem != NULL)
-                {
-                    tmp = TAILQ_NEXT(tmp_elem, ENTRYS);
-                    if(tmp_elem->free_cb != NULL)
-                    {
-                        tmp_elem->free_cb(tmp_elem->event);
-                    }
-                    free(tmp_elem);
-                    tmp_elem = tmp;
-                }
-            }
-            free(_timer->timer_wheel.spokes);
-            break;
-        }
-        default:
-            break;
+        n <<= 1;
+        shift ++;
     }
-    free(timer);
-    return;
+    pool->free_list = NULL;
+    pool->slabs = NULL;
+    pool->intervals = NULL;
+    pool->slab_cnt = 0;
+    pool->slab_cap = 0;
+    pool->slab_elems = n;
+    pool->slab_shift = shift;
+    pool->bump_slab = 0;
+    pool->bump_off = 0;
 }
 
 
-
-int MESA_timer_add(MESA_timer_t *timer, 
-                   long current_time, 
-                   long timeout,
-                   timeout_cb_t timeout_cb,
-                   void *event, 
-                   event_free_cb_t free_cb,
-                   MESA_timer_index_t **index)
+static void timer_pool_grow(MESA_timer_inner_t *_timer)
 {
-    assert(timer != 0 && current_time >= 0 && timeout >= 0);
+    timer_pool_t *pool = &(_timer->pool);
 
-    MESA_timer_inner_t *_timer = (MESA_timer_inner_t *)timer;
-    switch(_timer->type)
+    if(pool->slab_cnt == pool->slab_cap)
     {
-        case TM_TYPE_QUEUE:
-        {
-            long expire = current_time + timeout;
-            if(expire < _timer->timer_queue.last_expire_time)
-            {
-                *index = NULL;
-                return -1;
-            }
-            _timer->timer_queue.last_expire_time = expire;
+        long cap = pool->slab_cap ? pool->slab_cap * 2 : 16;
+        pool->slabs = (timer_elem_t **)realloc(pool->slabs, sizeof(timer_elem_t *) * cap);
+        pool->intervals = (long **)realloc(pool->intervals, sizeof(long *) * cap);
+        memset(pool->intervals + pool->slab_cap, 0, sizeof(long *) * (cap - pool->slab_cap));
+        _timer->mem_ocupy += (sizeof(timer_elem_t *) + sizeof(long *)) * (cap - pool->slab_cap);
+        pool->slab_cap = cap;
+    }
+    pool->slabs[pool->slab_cnt++] = (timer_elem_t *)malloc(sizeof(timer_elem_t) * pool->slab_elems);
+    _timer->mem_ocupy += sizeof(timer_elem_t) * pool->slab_elems;
+}
 
-            timer_elem_t *elem = (timer_elem_t *)malloc(sizeof(timer_elem_t));
-            elem->expire = expire;
-            elem->timeout_cb = timeout_cb;
 
-            elem->event = event;
-            elem->free_cb = free_cb;
-            /* insert a timer ENTRYS to tail of timer queue */
-            TAILQ_INSERT_TAIL(&(_timer->timer_queue.queue), elem, ENTRYS);
-            elem->status= IN_TIMER;
+static inline timer_elem_t *timer_pool_alloc_slow(MESA_timer_inner_t *_timer)
+{
+    timer_pool_t *pool = &(_timer->pool);
+    timer_elem_t *elem;
 
-            _timer->elem_cnt += 1;
-            _timer->mem_ocupy += sizeof(timer_elem_t);
+    if(pool->bump_off == pool->slab_elems)
+    {
+        pool->bump_slab ++;
+        pool->bump_off = 0;
+    }
+    if(pool->bump_slab == pool->slab_cnt)
+    {
+        timer_pool_grow(_timer);
+    }
+    elem = &(pool->slabs[pool->bump_slab][pool->bump_off]);
+    elem->id = (pool->bump_slab << pool->slab_shift) + pool->bump_off;
+    elem->gen = 1;
+    pool->bump_off ++;
+    return elem;
+}
 
-            *index = (MESA_timer_index_t *)elem;
-            return 0;
-        }
-        case TM_TYPE_WHEEL:
-        {
-            timer_wheel_t *wheel = &(_timer->timer_wheel);
 
-            /* the first timer ENTRYS start the timer, and current_time's relative time is 0 */
-            if(wheel->last_check_relative_tick == -1)
-            {
-                wheel->create_time = current_time;
-                wheel->spoke_index = 0;
-                wheel->last_check_relative_tick = 0;
-            }
+static inline timer_elem_t *timer_pool_alloc(MESA_timer_inner_t *_timer)
+{
+    timer_elem_t *elem = _timer->pool.free_list;
 
-            timer_elem_t *elem = (timer_elem_t *)malloc(sizeof(timer_elem_t));
-            elem->expire = current_time + timeout;
-            elem->timeout_cb = timeout_cb;
+    if(elem == NULL)
+    {
+        elem = timer_pool_alloc_slow(_timer);
+    }
+    else
+    {
+        _timer->pool.free_list = TAILQ_NEXT(elem, ENTRYS);
+        _timer->pool.free_cnt --;
+    }
+    elem->flags = 0;
+    return elem;
+}
 
-            elem->event = event;
-            elem->free_cb = free_cb;
 
-            long td = timeout % wheel->wheel_size;
-            elem->rotation_cnt = timeout / wheel->wheel_size;
-            long cursor = (current_time - wheel->create_time + td) % wheel->wheel_size;
-            elem->cursor = cursor;
+/**
+ * A new generation makes handles of elem stale. An elem whose generation
+ * wraps is retired with generation 0, which no handle has, so that a stale
+ * handle never matches again.
+ **/
+static inline void timer_pool_free(MESA_timer_inner_t *_timer, timer_elem_t *elem)
+{
+    elem->gen = (elem->gen + 1) & HANDLE_GEN_MASK;
+    if(elem->gen == 0)
+    {
+        return;
+    }
+    TAILQ_NEXT(elem, ENTRYS) = _timer->pool.free_list;
+    _timer->pool.free_list = elem;
+    _timer->pool.free_cnt ++;
+}
 
-            /* insert a timer ENTRYS to tail of timer queue */
-            TAILQ_INSERT_TAIL(&(wheel->spokes[cursor]), elem, ENTRYS);
-            elem->status = IN_TIMER;
 
-            /* update stat data */
-            _timer->elem_cnt += 1;
-            _timer->mem_ocupy += sizeof(timer_elem_t);
+/* Bytes of slabs the pool must allocate to hand out cnt more elements */
+static inline long timer_pool_need_bytes(timer_pool_t *pool, long cnt)
+{
+    long left = pool->free_cnt + (pool->slab_cnt - pool->bump_slab) * pool->slab_elems - pool->bump_off;
 
-            *index = (MESA_timer_index_t *)elem;
-            return 0;
-        }
-        default:
-        {
-            *index = NULL;
-            return -1;
-        }
+    if(cnt <= left)
+    {
+        return 0;
     }
+    return (cnt - left + pool->slab_elems - 1) / pool->slab_elems * pool->slab_elems * (long)sizeof(timer_elem_t);
 }
 
 
-
-long MESA_timer_del(MESA_timer_t *timer, MESA_timer_index_t* index)
+static inline MESA_timer_handle_t timer_pool_handle(timer_elem_t *elem)
 {
-    assert(timer != NULL && index != NULL);
+    return ((MESA_timer_handle_t)elem->gen << HANDLE_INDEX_BITS) | elem->id;
+}
 
-    MESA_timer_inner_t *_timer = (MESA_timer_inner_t *)timer;
-    timer_elem_t *elem = (timer_elem_t *)index;
 
-    if(elem->status == NOT_IN_TIMER)
+/* Element of handle, NULL if the handle is stale or has never been given */
+static inline timer_elem_t *timer_pool_lookup(timer_pool_t *pool, MESA_timer_handle_t handle)
+{
+    long index = handle & HANDLE_INDEX_MASK;
+    timer_elem_t *elem;
+
+    if(index >= (pool->bump_slab << pool->slab_shift) + pool->bump_off)
     {
-        return -1;
+        return NULL;
     }
-
-    long ret_timeout = -1;
-    switch(_timer->type)
+    elem = &(pool->slabs[index >> pool->slab_shift][index & (pool->slab_elems - 1)]);
+    if(elem->gen != (handle >> HANDLE_INDEX_BITS))
     {
-        case TM_TYPE_QUEUE:
-        {
-            ret_timeout = elem->expire;
-            /* remove from timer queue */
-            TAILQ_REMOVE(&(_timer->timer_queue.queue), elem, ENTRYS);
-            elem->status = NOT_IN_TIMER;
+        return NULL;
+    }
+    return elem;
+}
 
-            _timer->elem_cnt --;
-            _timer->mem_ocupy -= sizeof(timer_elem_t);
 
-            /* update timer queue's last_expire_time */
-            if(!TAILQ_EMPTY(&(_timer->timer_queue.queue)))
-            {
-                timer_elem_t *tail = TAILQ_LAST(&(_timer->timer_queue.queue), TQ);
-                _timer->timer_queue.last_expire_time = tail->expire;
-            }
-            else
-            {
-                _timer->timer_queue.last_expire_time = -1;
-            }
+/* Give elem back to the node pool unless it is a node owned by user */
+static inline void timer_elem_release(MESA_timer_inner_t *_timer, timer_elem_t *elem)
+{
+    if(!(elem->flags & ELEM_FLAG_NODE))
+    {
+        timer_pool_free(_timer, elem);
+    }
+}
 
-            if(elem->free_cb != NULL)
-            {
-                elem->free_cb(elem->event);
-            }
-            free(elem);
-            break;
-        }
-        case TM_TYPE_WHEEL:
-        {
-            ret_timeout = elem->expire;
-            TAILQ_REMOVE(&(_timer->timer_wheel.spokes[elem->cursor]), elem, ENTRYS);
-            elem->status = NOT_IN_TIMER;
 
-            _timer->elem_cnt --;
-            _timer->mem_ocupy -= sizeof(timer_elem_t);
+/* Interval of a periodic elem, the array of its slab is allocated on first use */
+static inline long *timer_pool_interval(MESA_timer_inner_t *_timer, timer_elem_t *elem)
+{
+    timer_pool_t *pool = &(_timer->pool);
+    long slab = elem->id >> pool->slab_shift;
 
-            if(elem->free_cb != NULL)
+    if(pool->intervals[slab] == NULL)
+    {
+        pool->intervals[slab] = (long *)malloc(sizeof(long) * pool->slab_elems);
+        _timer->mem_ocupy += sizeof(long) * pool->slab_elems;
+    }
+    return &(pool->intervals[slab][elem->id & (pool->slab_elems - 1)]);
+}
+
+
+static void timer_pool_destroy(timer_pool_t *pool)
+{
+    long i;
+    for(i = 0; i < pool->slab_cnt; i++)
+    {
+        free(pool->slabs[i]);
+        free(pool->intervals[i]);
+    }
+    free(pool->slabs);
+    free(pool->intervals);
+}
+
+
+
+static inline void bitmap_set(unsigned long *map, long bit)
+{
+    map[bit / BITMAP_WORD_BITS] |= 1UL << (bit % BITMAP_WORD_BITS);
+}
+
+static inline void bitmap_clear(unsigned long *map, long bit)
+{
+    map[bit / BITMAP_WORD_BITS] &= ~(1UL << (bit % BITMAP_WORD_BITS));
+}
+
+/* first set bit in [start, nbits), -1 if there is none */
+static long bitmap_find_next(const unsigned long *map, long nbits, long start)
+{
+    long i = start / BITMAP_WORD_BITS;
+    unsigned long word;
+
+    if(start >= nbits)
+        return -1;
+    word = map[i] & (~0UL << (start % BITMAP_WORD_BITS));
+    while(word == 0)
+    {
+        if(++i >= BITMAP_WORDS(nbits))
+            return -1;
+        word = map[i];
+    }
+    start = i * BITMAP_WORD_BITS + __builtin_ctzl(word);
+    return start < nbits ? start : -1;
+}
+
+
+
+/**
+ * File elem into the time wheel by its expire. Spokes are filed relative to
+ * the last checked tick, so that ticks not yet checked keep their spokes.
+ * An elem already due is filed into the current spoke.
+ **/
+static void wheel_insert(timer_wheel_t *wheel, timer_elem_t *elem)
+{
+    long distance = elem->expire - wheel->create_time - wheel->last_check_relative_tick;
+    if(distance < 0)
+    {
+        distance = 0;
+    }
+
+    elem->rotation_cnt = distance / wheel->wheel_size;
+    elem->cursor = (wheel->spoke_index + distance % wheel->wheel_size) % wheel->wheel_size;
+    elem->flags = (elem->flags & ~ELEM_FLAG_EPOCH) | wheel->epoch;
+    TAILQ_INSERT_TAIL(&(wheel->spokes[elem->cursor]), elem, ENTRYS);
+    bitmap_set(wheel->bitmap, elem->cursor);
+}
+
+
+static void wheel_remove(timer_wheel_t *wheel, timer_elem_t *elem)
+{
+    struct TQ *spokes = wheel->spokes;
+    unsigned long *bitmap = wheel->bitmap;
+
+    /* not moved since resizing */
+    if(wheel->old_spokes != NULL && (elem->flags & ELEM_FLAG_EPOCH) != wheel->epoch)
+    {
+        spokes = wheel->old_spokes;
+        bitmap = wheel->old_bitmap;
+    }
+    TAILQ_REMOVE(&(spokes[elem->cursor]), elem, ENTRYS);
+    if(TAILQ_EMPTY(&(spokes[elem->cursor])))
+    {
+        bitmap_clear(bitmap, elem->cursor);
+    }
+}
+
+
+/* Ticks from the current spoke to the nearest non-empty spoke, -1 if none */
+static long wheel_next_distance(timer_wheel_t *wheel)
+{
+    long spoke = bitmap_find_next(wheel->bitmap, wheel->wheel_size, wheel->spoke_index);
+    if(spoke != -1)
+    {
+        return spoke - wheel->spoke_index;
+    }
+    spoke = bitmap_find_next(wheel->bitmap, wheel->wheel_size, 0);
+    if(spoke != -1)
+    {
+        return wheel->wheel_size + spoke - wheel->spoke_index;
+    }
+    return -1;
+}
+
+
+static inline void wheel_skip(timer_wheel_t *wheel, long tickcnt)
+{
+    wheel->last_check_relative_tick += tickcnt;
+    wheel->spoke_index = (wheel->spoke_index + tickcnt) % wheel->wheel_size;
+}
+
+
+/**
+ * Pass the wheel over spoke for passes times at once: ENTRYS whose rotations
+ * run out within the passes are moved into the expired list, the others'
+ * rotation_cnt are reduced by passes. An ENTRYS whose expire has been delayed
+ * beyond due by a lazy reset is moved into refile instead.
+ **/
+static long wheel_sweep_spoke(MESA_timer_inner_t *_timer, long spoke, long passes, long due, struct TQ *refile)
+{
+    timer_wheel_t *wheel = &(_timer->timer_wheel);
+    struct TQ *queue = &(wheel->spokes[spoke]);
+    timer_elem_t *tmp_elem = TAILQ_FIRST(queue);
+    timer_elem_t *tmp;
+    long moved = 0, visited = 0;
+
+    while(tmp_elem != NULL)
+    {
+        tmp = TAILQ_NEXT(tmp_elem, ENTRYS);
+        visited ++;
+        if(tmp_elem->rotation_cnt < passes)
+        {
+            TAILQ_REMOVE(queue, tmp_elem, ENTRYS);
+            if(tmp_elem->expire > due)
+            {
+                TAILQ_INSERT_TAIL(refile, tmp_elem, ENTRYS);
+            }
+            else
+            {
+                tmp_elem->cursor = EXPIRED_CURSOR;
+                TAILQ_INSERT_TAIL(&(_timer->expired), tmp_elem, ENTRYS);
+                moved ++;
+            }
+        }
+        else
+        {
+            tmp_elem->rotation_cnt -= passes;
+        }
+        tmp_elem = tmp;
+    }
+    if(TAILQ_EMPTY(queue))
+    {
+        bitmap_clear(wheel->bitmap, spoke);
+    }
+    STATS_ADD(_timer, visited_cnt, visited);
+    return moved;
+}
+
+
+/* File ENTRYS delayed by lazy resets again, after the wheel passed their old spokes */
+static void wheel_refile(timer_wheel_t *wheel, struct TQ *refile)
+{
+    timer_elem_t *tmp_elem;
+
+    while((tmp_elem = TAILQ_FIRST(refile)) != NULL)
+    {
+        TAILQ_REMOVE(refile, tmp_elem, ENTRYS);
+        wheel_insert(wheel, tmp_elem);
+    }
+}
+
+
+/**
+ * Catch up tickcnt >= wheel_size ticks in one pass over the non-empty spokes:
+ * spoke at distance d from the current spoke is passed (tickcnt-1-d)/size+1
+ * times. Costs O(wheel_size / 64 + ENTRYS) instead of O(tickcnt * ENTRYS).
+ * Due ENTRYS are moved to the expired list in spoke order.
+ **/
+static long wheel_fast_forward(MESA_timer_inner_t *_timer, long tickcnt)
+{
+    timer_wheel_t *wheel = &(_timer->timer_wheel);
+    long spoke = -1, moved = 0;
+    long due = wheel->create_time + wheel->last_check_relative_tick + tickcnt - 1;
+    struct TQ refile;
+
+    TAILQ_INIT(&refile);
+    while((spoke = bitmap_find_next(wheel->bitmap, wheel->wheel_size, spoke + 1)) != -1)
+    {
+        long distance = (spoke - wheel->spoke_index + wheel->wheel_size) % wheel->wheel_size;
+        moved += wheel_sweep_spoke(_timer, spoke, (tickcnt - 1 - distance) / wheel->wheel_size + 1, due, &refile);
+    }
+    wheel_skip(wheel, tickcnt);
+    wheel_refile(wheel, &refile);
+    return moved;
+}
+
+
+/* Free old spokes of a resized time wheel, all ENTRYSs are moved */
+static void wheel_migrate_done(MESA_timer_inner_t *_timer)
+{
+    timer_wheel_t *wheel = &(_timer->timer_wheel);
+
+    free(wheel->old_spokes);
+    free(wheel->old_bitmap);
+    _timer->mem_ocupy -= sizeof(struct TQ) * wheel->old_size + sizeof(unsigned long) * BITMAP_WORDS(wheel->old_size);
+    wheel->old_spokes = NULL;
+    wheel->old_bitmap = NULL;
+    wheel->old_size = 0;
+}
+
+
+/* Move the ENTRYSs of an old spoke to spokes by their expire */
+static long wheel_migrate_spoke(timer_wheel_t *wheel, long spoke)
+{
+    timer_elem_t *tmp_elem;
+    long moved = 0;
+
+    while((tmp_elem = TAILQ_FIRST(&(wheel->old_spokes[spoke]))) != NULL)
+    {
+        TAILQ_REMOVE(&(wheel->old_spokes[spoke]), tmp_elem, ENTRYS);
+        wheel_insert(wheel, tmp_elem);
+        moved ++;
+    }
+    bitmap_clear(wheel->old_bitmap, spoke);
+    return moved;
+}
+
+
+/**
+ * Move ENTRYSs of a resized time wheel from old spokes, before checking to
+ * current_time: every old spoke which the ticks up to current_time pass,
+ * and then RESIZE_MIGRATE_ELEMS ENTRYSs more of the following old spokes.
+ **/
+static void wheel_migrate(MESA_timer_inner_t *_timer, long current_time)
+{
+    timer_wheel_t *wheel = &(_timer->timer_wheel);
+    long due = current_time - wheel->old_base + 1, moved = 0;
+
+    while(wheel->migrated < wheel->old_size && (wheel->migrated < due || moved < RESIZE_MIGRATE_ELEMS))
+    {
+        moved += wheel_migrate_spoke(wheel, (wheel->old_index + wheel->migrated) % wheel->old_size);
+        wheel->migrated ++;
+    }
+    if(wheel->migrated == wheel->old_size)
+    {
+        wheel_migrate_done(_timer);
+    }
+}
+
+
+static void wheel_migrate_all(MESA_timer_inner_t *_timer)
+{
+    timer_wheel_t *wheel = &(_timer->timer_wheel);
+    long spoke = -1;
+
+    if(wheel->old_spokes == NULL)
+        return;
+    while((spoke = bitmap_find_next(wheel->old_bitmap, wheel->old_size, spoke + 1)) != -1)
+    {
+        wheel_migrate_spoke(wheel, spoke);
+    }
+    wheel_migrate_done(_timer);
+}
+
+
+/* Earliest time an ENTRYS left in old spokes may expire, -1 if none */
+static long wheel_old_next(timer_wheel_t *wheel)
+{
+    long spoke = bitmap_find_next(wheel->old_bitmap, wheel->old_size, (wheel->old_index + wheel->migrated) % wheel->old_size);
+
+    if(spoke == -1)
+    {
+        spoke = bitmap_find_next(wheel->old_bitmap, wheel->old_size, 0);
+        if(spoke == -1)
+            return -1;
+    }
+    return wheel->old_base + (spoke - wheel->old_index + wheel->old_size) % wheel->old_size + 1;
+}
+
+
+/**
+ * Give the time wheel new_size spokes. ENTRYSs stay in old spokes and are
+ * moved by the following checks, a former resizing is finished first.
+ **/
+static void wheel_resize(MESA_timer_inner_t *_timer, long new_size)
+{
+    timer_wheel_t *wheel = &(_timer->timer_wheel);
+    long i;
+
+    if(new_size == wheel->wheel_size)
+        return;
+    wheel_migrate_all(_timer);
+
+    wheel->old_spokes = wheel->spokes;
+    wheel->old_bitmap = wheel->bitmap;
+    wheel->old_size = wheel->wheel_size;
+    wheel->old_index = wheel->spoke_index;
+    wheel->old_base = wheel->create_time == -1 ? 0 : wheel->create_time + wheel->last_check_relative_tick;
+    wheel->migrated = 0;
+
+    wheel->spokes = (struct TQ *)malloc(sizeof(struct TQ) * new_size);
+    for(i = 0; i < new_size; i++)
+    {
+        TAILQ_INIT(&(wheel->spokes[i]));
+    }
+    wheel->bitmap = (unsigned long *)calloc(BITMAP_WORDS(new_size), sizeof(unsigned long));
+    wheel->wheel_size = new_size;
+    wheel->spoke_index = 0;
+    wheel->epoch ^= ELEM_FLAG_EPOCH;
+    _timer->mem_ocupy += sizeof(struct TQ) * new_size + sizeof(unsigned long) * BITMAP_WORDS(new_size);
+
+    if(bitmap_find_next(wheel->old_bitmap, wheel->old_size, 0) == -1)
+    {
+        wheel_migrate_done(_timer);
+    }
+}
+
+
+static inline void wheel_tune_sample(MESA_timer_inner_t *_timer, long timeout)
+{
+    if(_timer->auto_resize)
+    {
+        _timer->tune_hist[stats_bucket(timeout)] ++;
+        _timer->tune_samples ++;
+    }
+}
+
+
+/* Resize the time wheel to hold AUTO_RESIZE_PCT of sampled timeouts in one revolution */
+static void wheel_auto_resize(MESA_timer_inner_t *_timer)
+{
+    timer_wheel_t *wheel = &(_timer->timer_wheel);
+    long sum = 0, target;
+    int bucket;
+
+    /* bucket i holds timeouts below 2^i */
+    for(bucket = 0; bucket < MESA_TIMER_HIST_BUCKETS - 1; bucket++)
+    {
+        sum += _timer->tune_hist[bucket];
+        if(sum * 100 >= _timer->tune_samples * AUTO_RESIZE_PCT)
+            break;
+    }
+    target = 1L << bucket;
+    if(target < AUTO_RESIZE_MIN)
+        target = AUTO_RESIZE_MIN;
+    if(target > MAX_WHEEL_SIZE)
+        target = MAX_WHEEL_SIZE;
+
+    /* leave sizes near the target alone */
+    if(target >= wheel->wheel_size * 2 || target * 4 <= wheel->wheel_size)
+    {
+        wheel_resize(_timer, target);
+    }
+    memset(_timer->tune_hist, 0, sizeof(_timer->tune_hist));
+    _timer->tune_samples = 0;
+}
+
+
+
+static void swheel_scan_scalar(int *rotations, long cnt, int passes, unsigned long *due)
+{
+    long i;
+
+    memset(due, 0, sizeof(unsigned long) * BITMAP_WORDS(cnt));
+    for(i = 0; i < cnt; i++)
+    {
+        rotations[i] -= passes;
+        if(rotations[i] < 0)
+        {
+            due[i / BITMAP_WORD_BITS] |= 1UL << (i % BITMAP_WORD_BITS);
+        }
+    }
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+static void swheel_scan_sse2(int *rotations, long cnt, int passes, unsigned long *due)
+{
+    __m128i p = _mm_set1_epi32(passes);
+    long i;
+
+    memset(due, 0, sizeof(unsigned long) * BITMAP_WORDS(cnt));
+    for(i = 0; i + 4 <= cnt; i += 4)
+    {
+        __m128i r = _mm_sub_epi32(_mm_loadu_si128((__m128i *)(rotations + i)), p);
+        _mm_storeu_si128((__m128i *)(rotations + i), r);
+        due[i / BITMAP_WORD_BITS] |= (unsigned long)_mm_movemask_ps(_mm_castsi128_ps(r)) << (i % BITMAP_WORD_BITS);
+    }
+    for(; i < cnt; i++)
+    {
+        rotations[i] -= passes;
+        if(rotations[i] < 0)
+        {
+            due[i / BITMAP_WORD_BITS] |= 1UL << (i % BITMAP_WORD_BITS);
+        }
+    }
+}
+
+
+__attribute__((target("avx2")))
+static void swheel_scan_avx2(int *rotations, long cnt, int passes, unsigned long *due)
+{
+    __m256i p = _mm256_set1_epi32(passes);
+    long i;
+
+    memset(due, 0, sizeof(unsigned long) * BITMAP_WORDS(cnt));
+    for(i = 0; i + 8 <= cnt; i += 8)
+    {
+        __m256i r = _mm256_sub_epi32(_mm256_loadu_si256((__m256i *)(rotations + i)), p);
+        _mm256_storeu_si256((__m256i *)(rotations + i), r);
+        due[i / BITMAP_WORD_BITS] |= (unsigned long)_mm256_movemask_ps(_mm256_castsi256_ps(r)) << (i % BITMAP_WORD_BITS);
+    }
+    for(; i < cnt; i++)
+    {
+        rotations[i] -= passes;
+        if(rotations[i] < 0)
+        {
+            due[i / BITMAP_WORD_BITS] |= 1UL << (i % BITMAP_WORD_BITS);
+        }
+    }
+}
+#endif
+
+
+static swheel_scan_t swheel_select_scan(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        return swheel_scan_avx2;
+    if(__builtin_cpu_supports("sse2"))
+        return swheel_scan_sse2;
+#endif
+    return swheel_scan_scalar;
+}
+
+
+static void swheel_grow_spoke(MESA_timer_inner_t *_timer, timer_swheel_spoke_t *spoke)
+{
+    timer_swheel_t *sw = &(_timer->timer_swheel);
+    int capacity = spoke->capacity ? spoke->capacity * 2 : SWHEEL_SPOKE_INIT;
+
+    spoke->rotations = (int *)realloc(spoke->rotations, sizeof(int) * capacity);
+    spoke->elems = (timer_elem_t **)realloc(spoke->elems, sizeof(timer_elem_t *) * capacity);
+    _timer->mem_ocupy += (sizeof(int) + sizeof(timer_elem_t *)) * (capacity - spoke->capacity);
+    spoke->capacity = capacity;
+
+    if(BITMAP_WORDS(capacity) > sw->due_words)
+    {
+        sw->due = (unsigned long *)realloc(sw->due, sizeof(unsigned long) * BITMAP_WORDS(capacity));
+        _timer->mem_ocupy += sizeof(unsigned long) * (BITMAP_WORDS(capacity) - sw->due_words);
+        sw->due_words = BITMAP_WORDS(capacity);
+    }
+}
+
+
+/* The same as wheel_insert, but append elem to the arrays of its spoke */
+/* Append elem to spoke cursor with rotations left */
+static void swheel_push(MESA_timer_inner_t *_timer, timer_elem_t *elem, long cursor, int rotations)
+{
+    timer_swheel_t *sw = &(_timer->timer_swheel);
+    timer_swheel_spoke_t *spoke = &(sw->spokes[cursor]);
+
+    if(spoke->cnt == spoke->capacity)
+    {
+        swheel_grow_spoke(_timer, spoke);
+    }
+    spoke->rotations[spoke->cnt] = rotations;
+    spoke->elems[spoke->cnt] = elem;
+    elem->cursor = cursor;
+    elem->rotation_cnt = spoke->cnt++;
+    bitmap_set(sw->wheel.bitmap, cursor);
+}
+
+
+static void swheel_insert(MESA_timer_inner_t *_timer, timer_elem_t *elem)
+{
+    timer_wheel_t *wheel = &(_timer->timer_swheel.wheel);
+    long distance = elem->expire - wheel->create_time - wheel->last_check_relative_tick;
+
+    if(distance < 0)
+    {
+        distance = 0;
+    }
+    swheel_push(_timer, elem, (wheel->spoke_index + distance % wheel->wheel_size) % wheel->wheel_size,
+                distance / wheel->wheel_size < INT_MAX ? distance / wheel->wheel_size : INT_MAX);
+}
+
+
+/* Remove the element at pos of spoke by moving the last one there */
+static inline void swheel_remove_at(timer_swheel_t *sw, long cursor, int pos)
+{
+    timer_swheel_spoke_t *spoke = &(sw->spokes[cursor]);
+    int last = --spoke->cnt;
+
+    if(pos != last)
+    {
+        spoke->rotations[pos] = spoke->rotations[last];
+        spoke->elems[pos] = spoke->elems[last];
+        spoke->elems[pos]->rotation_cnt = pos;
+    }
+    if(last == 0)
+    {
+        bitmap_clear(sw->wheel.bitmap, cursor);
+    }
+}
+
+
+static void swheel_remove(timer_swheel_t *sw, timer_elem_t *elem)
+{
+    swheel_remove_at(sw, elem->cursor, elem->rotation_cnt);
+}
+
+
+/**
+ * The same as wheel_sweep_spoke: rotations of the spoke are reduced in bulk,
+ * then due elements are moved into the expired list in array order, or into
+ * refile when a lazy reset delayed them beyond due.
+ **/
+static long swheel_sweep_spoke(MESA_timer_inner_t *_timer, long cursor, long passes, long due, struct TQ *refile)
+{
+    timer_swheel_t *sw = &(_timer->timer_swheel);
+    timer_swheel_spoke_t *spoke = &(sw->spokes[cursor]);
+    long words = BITMAP_WORDS(spoke->cnt), moved = 0, w;
+    unsigned long word;
+    timer_elem_t *tmp_elem;
+
+    sw->scan(spoke->rotations, spoke->cnt, passes < INT_MAX ? passes : INT_MAX, sw->due);
+    STATS_ADD(_timer, visited_cnt, spoke->cnt);
+
+    for(w = 0; w < words; w++)
+    {
+        for(word = sw->due[w]; word != 0; word &= word - 1)
+        {
+            tmp_elem = spoke->elems[w * BITMAP_WORD_BITS + __builtin_ctzl(word)];
+            if(tmp_elem->expire > due)
+            {
+                TAILQ_INSERT_TAIL(refile, tmp_elem, ENTRYS);
+            }
+            else
+            {
+                tmp_elem->cursor = EXPIRED_CURSOR;
+                TAILQ_INSERT_TAIL(&(_timer->expired), tmp_elem, ENTRYS);
+                moved ++;
+            }
+        }
+    }
+
+    /* backward, so that the last element moved into a hole is never due */
+    for(w = words - 1; w >= 0; w--)
+    {
+        for(word = sw->due[w]; word != 0; word &= ~(1UL << (BITMAP_WORD_BITS - 1 - __builtin_clzl(word))))
+        {
+            swheel_remove_at(sw, cursor, w * BITMAP_WORD_BITS + BITMAP_WORD_BITS - 1 - __builtin_clzl(word));
+        }
+    }
+    return moved;
+}
+
+
+static void swheel_refile(MESA_timer_inner_t *_timer, struct TQ *refile)
+{
+    timer_elem_t *tmp_elem;
+
+    while((tmp_elem = TAILQ_FIRST(refile)) != NULL)
+    {
+        TAILQ_REMOVE(refile, tmp_elem, ENTRYS);
+        swheel_insert(_timer, tmp_elem);
+    }
+}
+
+
+/* The same as wheel_fast_forward */
+static long swheel_fast_forward(MESA_timer_inner_t *_timer, long tickcnt)
+{
+    timer_wheel_t *wheel = &(_timer->timer_swheel.wheel);
+    long spoke = -1, moved = 0;
+    long due = wheel->create_time + wheel->last_check_relative_tick + tickcnt - 1;
+    struct TQ refile;
+
+    TAILQ_INIT(&refile);
+    while((spoke = bitmap_find_next(wheel->bitmap, wheel->wheel_size, spoke + 1)) != -1)
+    {
+        long distance = (spoke - wheel->spoke_index + wheel->wheel_size) % wheel->wheel_size;
+        moved += swheel_sweep_spoke(_timer, spoke, (tickcnt - 1 - distance) / wheel->wheel_size + 1, due, &refile);
+    }
+    wheel_skip(wheel, tickcnt);
+    swheel_refile(_timer, &refile);
+    return moved;
+}
+
+
+
+/**
+ * File elem into the hierarchical wheel by its expire. Elements due at
+ * ticks already checked are filed at the current tick, so that a callback
+ * resetting its own element does not fire it again in the same check.
+ * Elements beyond the top level are parked at its farthest slot and
+ * refiled on cascading.
+ **/
+static void hwheel_insert(MESA_timer_inner_t *_timer, timer_elem_t *elem)
+{
+    timer_hwheel_t *hw = &(_timer->timer_hwheel);
+    long expire = elem->expire;
+    long idx = expire - hw->current;
+    long slot;
+
+    if(idx < 0)
+    {
+        idx = 0;
+        expire = hw->current;
+    }
+
+    if(idx < HWHEEL_L0_SIZE)
+    {
+        slot = expire & HWHEEL_L0_MASK;
+    }
+    else
+    {
+        int level = 1, shift = HWHEEL_L0_BITS;
+        if(idx > HWHEEL_MAX_TICKS)
+        {
+            idx = HWHEEL_MAX_TICKS;
+            expire = hw->current + idx;
+        }
+        while(idx >= (1L << (shift + HWHEEL_LN_BITS)))
+        {
+            level ++;
+            shift += HWHEEL_LN_BITS;
+        }
+        slot = HWHEEL_L0_SIZE + (level - 1) * HWHEEL_LN_SIZE + ((expire >> shift) & HWHEEL_LN_MASK);
+    }
+
+    elem->cursor = slot;
+    TAILQ_INSERT_TAIL(&(hw->slots[slot]), elem, ENTRYS);
+    bitmap_set(hw->bitmap, slot);
+}
+
+
+static void hwheel_remove(timer_hwheel_t *hw, timer_elem_t *elem)
+{
+    TAILQ_REMOVE(&(hw->slots[elem->cursor]), elem, ENTRYS);
+    if(TAILQ_EMPTY(&(hw->slots[elem->cursor])))
+    {
+        bitmap_clear(hw->bitmap, elem->cursor);
+    }
+}
+
+
+/**
+ * The next tick (>= current) at which something happens in the wheel:
+ * either a level 0 slot fires or a non-empty upper slot cascades.
+ * Return -1 when the wheel is empty.
+ **/
+static long hwheel_next_tick(timer_hwheel_t *hw)
+{
+    long next = -1, tick;
+    long cur = hw->current & HWHEEL_L0_MASK;
+    long slot = bitmap_find_next(hw->bitmap, HWHEEL_L0_SIZE, cur);
+
+    if(slot >= 0)
+    {
+        next = hw->current + slot - cur;
+    }
+    else if((slot = bitmap_find_next(hw->bitmap, HWHEEL_L0_SIZE, 0)) >= 0)
+    {
+        next = hw->current + HWHEEL_L0_SIZE + slot - cur;
+    }
+
+    int level, shift = HWHEEL_L0_BITS;
+    for(level = 1; level < HWHEEL_LEVELS; level++, shift += HWHEEL_LN_BITS)
+    {
+        unsigned long word = hw->bitmap[(HWHEEL_L0_SIZE + (level - 1) * HWHEEL_LN_SIZE) / BITMAP_WORD_BITS];
+        if(word == 0)
+            continue;
+
+        /* the first slot boundary of this level which is not passed yet */
+        long block = (hw->current + (1L << shift) - 1) >> shift;
+        int rot = block & HWHEEL_LN_MASK;
+        if(rot != 0)
+        {
+            word = (word >> rot) | (word << (BITMAP_WORD_BITS - rot));
+        }
+        tick = (block + __builtin_ctzl(word)) << shift;
+        if(next == -1 || tick < next)
+        {
+            next = tick;
+        }
+    }
+    return next;
+}
+
+
+/* Refile all elements of an upper slot relative to the current tick */
+static void hwheel_cascade(MESA_timer_inner_t *_timer, long slot)
+{
+    timer_hwheel_t *hw = &(_timer->timer_hwheel);
+    struct TQ tmp_list;
+    timer_elem_t *tmp_elem;
+
+    TAILQ_INIT(&tmp_list);
+    TAILQ_CONCAT(&tmp_list, &(hw->slots[slot]), ENTRYS);
+    bitmap_clear(hw->bitmap, slot);
+
+    while((tmp_elem = TAILQ_FIRST(&tmp_list)) != NULL)
+    {
+        TAILQ_REMOVE(&tmp_list, tmp_elem, ENTRYS);
+        hwheel_insert(_timer, tmp_elem);
+        STATS_ADD(_timer, visited_cnt, 1);
+    }
+}
+
+
+/**
+ * Process the given tick: cascade upper levels on level 0 revolution
+ * and move every element of the tick's slot into the expired list,
+ * except those delayed by lazy resets, which are filed again.
+ **/
+static long hwheel_advance(MESA_timer_inner_t *_timer, long tick)
+{
+    timer_hwheel_t *hw = &(_timer->timer_hwheel);
+    long slot = tick & HWHEEL_L0_MASK;
+    long moved = 0;
+    timer_elem_t *tmp_elem;
+    struct TQ refile;
+
+    TAILQ_INIT(&refile);
+    hw->current = tick;
+    if(slot == 0)
+    {
+        int level, shift = HWHEEL_L0_BITS;
+        for(level = 1; level < HWHEEL_LEVELS; level++, shift += HWHEEL_LN_BITS)
+        {
+            long index = (tick >> shift) & HWHEEL_LN_MASK;
+            hwheel_cascade(_timer, HWHEEL_L0_SIZE + (level - 1) * HWHEEL_LN_SIZE + index);
+            if(index != 0)
+                break;
+        }
+    }
+
+    while((tmp_elem = TAILQ_FIRST(&(hw->slots[slot]))) != NULL)
+    {
+        TAILQ_REMOVE(&(hw->slots[slot]), tmp_elem, ENTRYS);
+        STATS_ADD(_timer, visited_cnt, 1);
+        if(tmp_elem->expire > tick)
+        {
+            TAILQ_INSERT_TAIL(&refile, tmp_elem, ENTRYS);
+            continue;
+        }
+        tmp_elem->cursor = EXPIRED_CURSOR;
+        TAILQ_INSERT_TAIL(&(_timer->expired), tmp_elem, ENTRYS);
+        moved ++;
+    }
+    bitmap_clear(hw->bitmap, slot);
+    hw->current = tick + 1;
+
+    while((tmp_elem = TAILQ_FIRST(&refile)) != NULL)
+    {
+        TAILQ_REMOVE(&refile, tmp_elem, ENTRYS);
+        hwheel_insert(_timer, tmp_elem);
+    }
+    return moved;
+}
+
+
+static void heap_grow(MESA_timer_inner_t *_timer)
+{
+    timer_heap_t *heap = &(_timer->timer_heap);
+    long capacity = heap->capacity ? heap->capacity * 2 : HEAP_INIT_CAPACITY;
+    void *base = NULL;
+
+    if(posix_memalign(&base, HEAP_ALIGN, sizeof(timer_heap_entry_t) * (capacity + HEAP_PAD)) != 0)
+    {
+        abort();
+    }
+    if(heap->entries != NULL)
+    {
+        memcpy((timer_heap_entry_t *)base + HEAP_PAD, heap->entries, sizeof(timer_heap_entry_t) * heap->size);
+        free(heap->entries - HEAP_PAD);
+    }
+    heap->entries = (timer_heap_entry_t *)base + HEAP_PAD;
+    _timer->mem_ocupy += sizeof(timer_heap_entry_t) * (capacity - heap->capacity);
+    heap->capacity = capacity;
+}
+
+
+static void heap_sift_up(timer_heap_t *heap, long pos, timer_heap_entry_t entry)
+{
+    while(pos > 0)
+    {
+        long parent = (pos - 1) / HEAP_ARITY;
+        if(heap->entries[parent].expire <= entry.expire)
+            break;
+        heap->entries[pos] = heap->entries[parent];
+        heap->entries[pos].elem->cursor = pos;
+        pos = parent;
+    }
+    heap->entries[pos] = entry;
+    entry.elem->cursor = pos;
+}
+
+
+static void heap_sift_down(timer_heap_t *heap, long pos, timer_heap_entry_t entry)
+{
+    while(1)
+    {
+        long child = pos * HEAP_ARITY + 1;
+        long last = child + HEAP_ARITY - 1, min, i;
+        if(child >= heap->size)
+            break;
+        if(last >= heap->size)
+            last = heap->size - 1;
+        for(min = child, i = child + 1; i <= last; i++)
+        {
+            if(heap->entries[i].expire < heap->entries[min].expire)
+                min = i;
+        }
+        if(heap->entries[min].expire >= entry.expire)
+            break;
+        heap->entries[pos] = heap->entries[min];
+        heap->entries[pos].elem->cursor = pos;
+        pos = min;
+    }
+    heap->entries[pos] = entry;
+    entry.elem->cursor = pos;
+}
+
+
+static void heap_insert(MESA_timer_inner_t *_timer, timer_elem_t *elem)
+{
+    timer_heap_t *heap = &(_timer->timer_heap);
+    timer_heap_entry_t entry;
+
+    if(heap->size == heap->capacity)
+    {
+        heap_grow(_timer);
+    }
+    entry.expire = elem->expire;
+    entry.elem = elem;
+    heap_sift_up(heap, heap->size++, entry);
+}
+
+
+static void heap_remove(timer_heap_t *heap, timer_elem_t *elem)
+{
+    long pos = elem->cursor;
+    timer_heap_entry_t last = heap->entries[--heap->size];
+
+    if(pos == heap->size)
+        return;
+    if(pos > 0 && heap->entries[(pos - 1) / HEAP_ARITY].expire > last.expire)
+        heap_sift_up(heap, pos, last);
+    else
+        heap_sift_down(heap, pos, last);
+}
+
+
+/* Move elem to its new expire in O(log n) */
+static void heap_update(timer_heap_t *heap, timer_elem_t *elem)
+{
+    long pos = elem->cursor;
+    timer_heap_entry_t entry = heap->entries[pos];
+
+    entry.expire = elem->expire;
+    if(pos > 0 && heap->entries[(pos - 1) / HEAP_ARITY].expire > entry.expire)
+        heap_sift_up(heap, pos, entry);
+    else
+        heap_sift_down(heap, pos, entry);
+}
+
+
+
+/* Class of timeout, a new class is opened when create is set. -1 if none */
+static int mqueue_class(timer_mqueue_t *mq, long timeout, int create)
+{
+    int i;
+
+    if(mq->class_cnt > 0 && mq->timeouts[mq->last_class] == timeout)
+        return mq->last_class;
+    for(i = 0; i < mq->class_cnt; i++)
+    {
+        if(mq->timeouts[i] == timeout)
+            break;
+    }
+    if(i == mq->class_cnt)
+    {
+        if(!create || mq->class_cnt == mq->class_max)
+            return -1;
+        mq->timeouts[mq->class_cnt++] = timeout;
+    }
+    mq->last_class = i;
+    return i;
+}
+
+
+/**
+ * Whether a periodic elem fits: its first period is filed in the class of
+ * first, the others in the class of interval, so both are checked before
+ * opening either.
+ **/
+static int mqueue_periodic_fits(timer_mqueue_t *mq, long first, long interval)
+{
+    int new_classes = (mqueue_class(mq, first, 0) == -1);
+
+    if(interval != first && mqueue_class(mq, interval, 0) == -1)
+    {
+        new_classes ++;
+    }
+    return mq->class_cnt + new_classes <= mq->class_max;
+}
+
+
+static void mqueue_update_min(timer_mqueue_t *mq)
+{
+    int i, min = -1;
+    long min_expire = LONG_MAX;
+
+    for(i = 0; i < mq->class_cnt; i++)
+    {
+        if(mq->head_expire[i] < min_expire)
+        {
+            min_expire = mq->head_expire[i];
+            min = i;
+        }
+    }
+    mq->min_class = min;
+}
+
+
+static void mqueue_update_head(timer_mqueue_t *mq, int cls)
+{
+    timer_elem_t *head = TAILQ_FIRST(&(mq->queues[cls]));
+    long old_expire = mq->head_expire[cls];
+
+    mq->head_expire[cls] = head != NULL ? head->expire : LONG_MAX;
+    if(mq->head_expire[cls] < old_expire)
+    {
+        if(mq->min_class == -1 || mq->head_expire[cls] < mq->head_expire[mq->min_class])
+            mq->min_class = cls;
+    }
+    else if(mq->head_expire[cls] != old_expire && mq->min_class == cls)
+    {
+        mqueue_update_min(mq);
+    }
+}
+
+
+/* Append elem to its class, going backward only when current_time goes back */
+static void mqueue_insert(timer_mqueue_t *mq, timer_elem_t *elem, int cls)
+{
+    struct TQ *queue = &(mq->queues[cls]);
+    timer_elem_t *tmp_elem = TAILQ_LAST(queue, TQ);
+
+    elem->cursor = cls;
+    while(tmp_elem != NULL && tmp_elem->expire > elem->expire)
+    {
+        tmp_elem = TAILQ_PREV(tmp_elem, TQ, ENTRYS);
+    }
+    if(tmp_elem == NULL)
+    {
+        TAILQ_INSERT_HEAD(queue, elem, ENTRYS);
+        mqueue_update_head(mq, cls);
+    }
+    else
+    {
+        TAILQ_INSERT_AFTER(queue, tmp_elem, elem, ENTRYS);
+    }
+}
+
+
+static void mqueue_remove(timer_mqueue_t *mq, timer_elem_t *elem)
+{
+    int is_head = (TAILQ_FIRST(&(mq->queues[elem->cursor])) == elem);
+
+    TAILQ_REMOVE(&(mq->queues[elem->cursor]), elem, ENTRYS);
+    if(is_head)
+    {
+        mqueue_update_head(mq, elem->cursor);
+    }
+}
+
+
+
+/**
+ * Move due ENTRYS into the expired list before calling back, so that ENTRYS
+ * added by callbacks wait for the next checking. Stop once want ENTRYS are
+ * moved, except that time wheel moves all due ENTRYS of a spoke together.
+ * Return the count moved, -1 when timer's type is unknown.
+ **/
+static long timer_gather_expired(MESA_timer_inner_t *_timer, long current_time, long want)
+{
+    timer_elem_t *tmp_elem;
+    long moved = 0;
+
+    switch(_timer->type)
+    {
+        case TM_TYPE_QUEUE:
+        {
+            struct TQ *queue = &(_timer->timer_queue.queue);
+
+            /* All ENTRYSs after the first undue one haven't time out */
+            while(moved < want && (tmp_elem = TAILQ_FIRST(queue)) != NULL && tmp_elem->expire <= current_time)
+            {
+                TAILQ_REMOVE(queue, tmp_elem, ENTRYS);
+                tmp_elem->cursor = EXPIRED_CURSOR;
+                TAILQ_INSERT_TAIL(&(_timer->expired), tmp_elem, ENTRYS);
+                moved ++;
+            }
+            STATS_ADD(_timer, visited_cnt, moved);
+            return moved;
+        }
+        case TM_TYPE_WHEEL:
+        {
+            timer_wheel_t *wheel = &(_timer->timer_wheel);
+            struct TQ refile;
+
+            if(wheel->create_time == -1)
+                return 0;
+            TAILQ_INIT(&refile);
+
+            if(_timer->auto_resize && _timer->tune_samples >= AUTO_RESIZE_SAMPLES)
+            {
+                wheel_auto_resize(_timer);
+            }
+            /* old spokes are moved before the ticks pass them, also those
+             * left by a resize just now */
+            if(wheel->old_spokes != NULL)
+            {
+                wheel_migrate(_timer, current_time);
+            }
+
+            long tickcnt = current_time - wheel->create_time - wheel->last_check_relative_tick;
+            if(tickcnt >= wheel->wheel_size)
+            {
+                /* after a long gap every spoke is passed at least once */
+                return wheel_fast_forward(_timer, tickcnt);
+            }
+
+            /* the rest ticks are checked next time when want is reached */
+            while(tickcnt > 0 && moved < want)
+            {
+                /* jump over empty spokes */
+                long distance = wheel_next_distance(wheel);
+                if(distance == -1 || distance >= tickcnt)
+                {
+                    wheel_skip(wheel, tickcnt);
+                    break;
+                }
+                wheel_skip(wheel, distance);
+                moved += wheel_sweep_spoke(_timer, wheel->spoke_index, 1, wheel->create_time + wheel->last_check_relative_tick, &refile);
+                wheel_skip(wheel, 1);
+                wheel_refile(wheel, &refile);
+                tickcnt -= distance + 1;
+            }
+            return moved;
+        }
+        case TM_TYPE_HWHEEL:
+        {
+            timer_hwheel_t *hw = &(_timer->timer_hwheel);
+
+            if(hw->current == -1)
+                return 0;
+
+            while(moved < want)
+            {
+                /* jump over the ticks at which nothing happens */
+                long tick = hwheel_next_tick(hw);
+                if(tick == -1 || tick > current_time)
+                {
+                    if(hw->current <= current_time)
+                    {
+                        hw->current = current_time + 1;
+                    }
+                    break;
+                }
+                moved += hwheel_advance(_timer, tick);
+            }
+            return moved;
+        }
+        case TM_TYPE_HEAP:
+        {
+            timer_heap_t *heap = &(_timer->timer_heap);
+
+            while(moved < want && heap->size > 0 && heap->entries[0].expire <= current_time)
+            {
+                tmp_elem = heap->entries[0].elem;
+                heap_remove(heap, tmp_elem);
+                tmp_elem->cursor = EXPIRED_CURSOR;
+                TAILQ_INSERT_TAIL(&(_timer->expired), tmp_elem, ENTRYS);
+                moved ++;
+            }
+            STATS_ADD(_timer, visited_cnt, moved);
+            return moved;
+        }
+        case TM_TYPE_MQUEUE:
+        {
+            timer_mqueue_t *mq = &(_timer->timer_mqueue);
+
+            while(moved < want && mq->min_class != -1 && mq->head_expire[mq->min_class] <= current_time)
+            {
+                tmp_elem = TAILQ_FIRST(&(mq->queues[mq->min_class]));
+                mqueue_remove(mq, tmp_elem);
+                tmp_elem->cursor = EXPIRED_CURSOR;
+                TAILQ_INSERT_TAIL(&(_timer->expired), tmp_elem, ENTRYS);
+                moved ++;
+            }
+            STATS_ADD(_timer, visited_cnt, moved);
+            return moved;
+        }
+        case TM_TYPE_SWHEEL:
+        {
+            timer_wheel_t *wheel = &(_timer->timer_swheel.wheel);
+            struct TQ refile;
+
+            if(wheel->create_time == -1)
+                return 0;
+            TAILQ_INIT(&refile);
+
+            long tickcnt = current_time - wheel->create_time - wheel->last_check_relative_tick;
+            if(tickcnt >= wheel->wheel_size)
+            {
+                return swheel_fast_forward(_timer, tickcnt);
+            }
+
+            while(tickcnt > 0 && moved < want)
+            {
+                long distance = wheel_next_distance(wheel);
+                if(distance == -1 || distance >= tickcnt)
+                {
+                    wheel_skip(wheel, tickcnt);
+                    break;
+                }
+                wheel_skip(wheel, distance);
+                moved += swheel_sweep_spoke(_timer, wheel->spoke_index, 1, wheel->create_time + wheel->last_check_relative_tick, &refile);
+                wheel_skip(wheel, 1);
+                swheel_refile(_timer, &refile);
+                tickcnt -= distance + 1;
+            }
+            return moved;
+        }
+        default:
+            return -1;
+    }
+}
+
+
+static int timer_insert_elem(MESA_timer_inner_t *_timer, long current_time, long timeout, timer_elem_t *elem);
+
+/**
+ * File a periodic elem fired at current_time again. Its next expire is one
+ * interval after current_time, or after its last expire on an absolute
+ * schedule, which skips whole periods already missed if asked to.
+ **/
+static int timer_rearm(MESA_timer_inner_t *_timer, timer_elem_t *elem, long current_time)
+{
+    long interval = *timer_pool_interval(_timer, elem);
+    long next = current_time + interval;
+
+    if(elem->flags & ELEM_FLAG_DRIFT_FREE)
+    {
+        next = elem->expire + interval;
+        if((elem->flags & ELEM_FLAG_SKIP_MISSED) && next <= current_time)
+        {
+            next += ((current_time - next) / interval + 1) * interval;
+        }
+    }
+    /* a time queue takes expires in order only */
+    if(_timer->type == TM_TYPE_QUEUE && next < _timer->timer_queue.last_expire_time)
+    {
+        next = _timer->timer_queue.last_expire_time;
+    }
+    return timer_insert_elem(_timer, next - interval, interval, elem);
+}
+
+
+/**
+ * Make a filed elem periodic with interval and MESA_TIMER_PERIODIC_* flags,
+ * a multi-class queue opens the class of interval checked to fit before.
+ **/
+static void timer_set_periodic(MESA_timer_inner_t *_timer, timer_elem_t *elem, long interval, int flags)
+{
+    if(_timer->type == TM_TYPE_MQUEUE)
+    {
+        mqueue_class(&(_timer->timer_mqueue), interval, 1);
+    }
+    *timer_pool_interval(_timer, elem) = interval;
+    elem->flags |= ELEM_FLAG_PERIODIC;
+    if(flags & MESA_TIMER_PERIODIC_DRIFT_FREE)
+    {
+        elem->flags |= ELEM_FLAG_DRIFT_FREE;
+        if(flags & MESA_TIMER_PERIODIC_SKIP_MISSED)
+        {
+            elem->flags |= ELEM_FLAG_SKIP_MISSED;
+        }
+    }
+}
+
+
+/* Whether elem is periodic and goes on after the callback just fired */
+static inline int timer_rearm_wanted(MESA_timer_inner_t *_timer, timer_elem_t *elem)
+{
+    return (elem->flags & (ELEM_FLAG_PERIODIC | ELEM_FLAG_STOPPED)) == ELEM_FLAG_PERIODIC && !_timer->evicting;
+}
+
+
+/**
+ * Invoke the callback of elem, which may free elem, and account for it:
+ * lateness of every callback, duration of one in STATS_CB_SAMPLE.
+ **/
+static inline void timer_invoke(MESA_timer_inner_t *_timer, timer_elem_t *elem, long current_time)
+{
+#ifndef MESA_TIMER_NO_STATS
+    MESA_timer_stats_t *stats = &(_timer->stats);
+
+    stats->lateness_hist[stats_bucket(current_time - elem->expire)] ++;
+    if((stats->fired_cnt++ & (STATS_CB_SAMPLE - 1)) == 0)
+    {
+        long start = stats_now_ns();
+        elem->timeout_cb(elem->event);
+        stats->callback_hist[stats_bucket(stats_now_ns() - start)] ++;
+        return;
+    }
+#endif
+    elem->timeout_cb(elem->event);
+}
+
+
+/**
+ * Invoke callbacks of elements in the expired list, at most max_cb_times.
+ * Return the count of callbacks.
+ **/
+static long timer_fire_expired(MESA_timer_inner_t *_timer, long current_time, long max_cb_times)
+{
+    long cb_cnt = 0;
+    timer_elem_t *tmp_elem, *firing;
+
+    while(cb_cnt < max_cb_times && (tmp_elem = TAILQ_FIRST(&(_timer->expired))) != NULL)
+    {
+        TAILQ_REMOVE(&(_timer->expired), tmp_elem, ENTRYS);
+        tmp_elem->status = NOT_IN_TIMER;
+
+        _timer->elem_cnt --;
+
+        /* a node may be freed with its event by callback, leave it alone */
+        if(tmp_elem->flags & ELEM_FLAG_NODE)
+        {
+            timer_invoke(_timer, tmp_elem, current_time);
+            cb_cnt ++;
+            continue;
+        }
+
+        firing = _timer->firing;
+        _timer->firing = tmp_elem;
+        timer_invoke(_timer, tmp_elem, current_time);
+        _timer->firing = firing;
+        cb_cnt ++;
+
+        /* the callback has not reset it */
+        if(tmp_elem->status == NOT_IN_TIMER)
+        {
+            if(timer_rearm_wanted(_timer, tmp_elem) && timer_rearm(_timer, tmp_elem, current_time) == 0)
+            {
+                continue;
+            }
+            if(tmp_elem->free_cb != NULL)
+            {
+                tmp_elem->free_cb(tmp_elem->event);
+            }
+            timer_pool_free(_timer, tmp_elem);
+        }
+    }
+    return cb_cnt;
+}
+
+
+/**
+ * Release in flight ENTRYSs whose callbacks are done, they are taken at once.
+ * Periodic ones are filed again at current_time, unless it is -1 or they
+ * were stopped, then their free_cb is called here.
+ **/
+static void timer_drain_done(MESA_timer_inner_t *_timer, long current_time)
+{
+    timer_elem_t *tmp_elem, *tmp;
+
+    if(__atomic_load_n(&(_timer->done_stack), __ATOMIC_RELAXED) == NULL)
+        return;
+    tmp_elem = __atomic_exchange_n(&(_timer->done_stack), NULL, __ATOMIC_ACQUIRE);
+    while(tmp_elem != NULL)
+    {
+        tmp = TAILQ_NEXT(tmp_elem, ENTRYS);
+        tmp_elem->status = NOT_IN_TIMER;
+        if(tmp_elem->flags & ELEM_FLAG_PERIODIC)
+        {
+            if(current_time != -1 && timer_rearm_wanted(_timer, tmp_elem)
+               && timer_rearm(_timer, tmp_elem, current_time) == 0)
+            {
+                tmp_elem = tmp;
+                continue;
+            }
+            if(tmp_elem->free_cb != NULL)
+            {
+                tmp_elem->free_cb(tmp_elem->event);
+            }
+        }
+        timer_pool_free(_timer, tmp_elem);
+        tmp_elem = tmp;
+    }
+}
+
+
+
+/* Move wheel's nearest ENTRYSs to the expired list, those of the current rotation first */
+static long wheel_evict(MESA_timer_inner_t *_timer, long want)
+{
+    timer_wheel_t *wheel = &(_timer->timer_wheel);
+    timer_elem_t *elem, *next;
+    long moved = 0, visited = 0, walked, spoke, found;
+    int pass;
+
+    /* a second pass takes ENTRYSs of any rotation in spoke order */
+    for(pass = 0; pass < 2 && moved < want; pass++)
+    {
+        spoke = wheel->spoke_index;
+        for(walked = 0; walked < wheel->wheel_size && moved < want; walked++, spoke++)
+        {
+            found = bitmap_find_next(wheel->bitmap, wheel->wheel_size, spoke);
+            if(found == -1)
+            {
+                found = bitmap_find_next(wheel->bitmap, wheel->wheel_size, 0);
+                if(found == -1)
+                    return moved;
+                walked += wheel->wheel_size - spoke + found;
+            }
+            else
+            {
+                walked += found - spoke;
+            }
+            if(walked >= wheel->wheel_size)
+                break;
+            spoke = found;
+
+            for(elem = TAILQ_FIRST(&(wheel->spokes[spoke])); elem != NULL && moved < want; elem = next)
+            {
+                next = TAILQ_NEXT(elem, ENTRYS);
+                if(pass == 0 && elem->rotation_cnt != 0)
+                {
+                    visited ++;
+                    continue;
+                }
+                wheel_remove(wheel, elem);
+                elem->cursor = EXPIRED_CURSOR;
+                TAILQ_INSERT_TAIL(&(_timer->expired), elem, ENTRYS);
+                moved ++;
+            }
+            if(pass == 0 && visited > want * EVICT_SCAN_FACTOR)
+                break;
+        }
+    }
+    return moved;
+}
+
+
+/* The same as wheel_evict for the array backed time wheel */
+static long swheel_evict(MESA_timer_inner_t *_timer, long want)
+{
+    timer_swheel_t *sw = &(_timer->timer_swheel);
+    timer_wheel_t *wheel = &(sw->wheel);
+    timer_elem_t *elem;
+    long moved = 0, visited = 0, walked, spoke, found;
+    int pass, pos;
+
+    for(pass = 0; pass < 2 && moved < want; pass++)
+    {
+        spoke = wheel->spoke_index;
+        for(walked = 0; walked < wheel->wheel_size && moved < want; walked++, spoke++)
+        {
+            found = bitmap_find_next(wheel->bitmap, wheel->wheel_size, spoke);
+            if(found == -1)
+            {
+                found = bitmap_find_next(wheel->bitmap, wheel->wheel_size, 0);
+                if(found == -1)
+                    return moved;
+                walked += wheel->wheel_size - spoke + found;
+            }
+            else
+            {
+                walked += found - spoke;
+            }
+            if(walked >= wheel->wheel_size)
+                break;
+            spoke = found;
+
+            /* descending, so that swap-remove only moves visited ENTRYSs */
+            for(pos = sw->spokes[spoke].cnt - 1; pos >= 0 && moved < want; pos--)
+            {
+                if(pass == 0 && sw->spokes[spoke].rotations[pos] != 0)
+                {
+                    visited ++;
+                    continue;
+                }
+                elem = sw->spokes[spoke].elems[pos];
+                swheel_remove_at(sw, spoke, pos);
+                elem->cursor = EXPIRED_CURSOR;
+                TAILQ_INSERT_TAIL(&(_timer->expired), elem, ENTRYS);
+                moved ++;
+            }
+            if(pass == 0 && visited > want * EVICT_SCAN_FACTOR)
+                break;
+        }
+    }
+    return moved;
+}
+
+
+/* Move hierarchical wheel's nearest ENTRYSs to the expired list, level by level */
+static long hwheel_evict(MESA_timer_inner_t *_timer, long want)
+{
+    timer_hwheel_t *hw = &(_timer->timer_hwheel);
+    timer_elem_t *elem;
+    long moved = 0, i, slot;
+    int level, shift;
+
+    for(i = 0; i < HWHEEL_SLOTS && moved < want; i++)
+    {
+        if(i < HWHEEL_L0_SIZE)
+        {
+            slot = (hw->current + i) & HWHEEL_L0_MASK;
+        }
+        else
+        {
+            /* from the first slot boundary of the level which is not passed yet */
+            level = 1 + (i - HWHEEL_L0_SIZE) / HWHEEL_LN_SIZE;
+            shift = HWHEEL_L0_BITS + (level - 1) * HWHEEL_LN_BITS;
+            slot = HWHEEL_L0_SIZE + (level - 1) * HWHEEL_LN_SIZE
+                   + ((((hw->current + (1L << shift) - 1) >> shift) + (i - HWHEEL_L0_SIZE) % HWHEEL_LN_SIZE) & HWHEEL_LN_MASK);
+        }
+        while(moved < want && (elem = TAILQ_FIRST(&(hw->slots[slot]))) != NULL)
+        {
+            hwheel_remove(hw, elem);
+            elem->cursor = EXPIRED_CURSOR;
+            TAILQ_INSERT_TAIL(&(_timer->expired), elem, ENTRYS);
+            moved ++;
+        }
+    }
+    return moved;
+}
+
+
+/**
+ * Move at most want ENTRYSs with the nearest expire to the expired list,
+ * whether they are due or not. Time wheels take them in spoke order, of
+ * the current rotation first. Return the count moved.
+ **/
+static long timer_evict_nearest(MESA_timer_inner_t *_timer, long want)
+{
+    timer_elem_t *tmp_elem;
+    long moved = 0;
+
+    switch(_timer->type)
+    {
+        case TM_TYPE_QUEUE:
+        {
+            struct TQ *queue = &(_timer->timer_queue.queue);
+            while(moved < want && (tmp_elem = TAILQ_FIRST(queue)) != NULL)
+            {
+                TAILQ_REMOVE(queue, tmp_elem, ENTRYS);
+                tmp_elem->cursor = EXPIRED_CURSOR;
+                TAILQ_INSERT_TAIL(&(_timer->expired), tmp_elem, ENTRYS);
+                moved ++;
+            }
+            return moved;
+        }
+        case TM_TYPE_WHEEL:
+            wheel_migrate_all(_timer);
+            return wheel_evict(_timer, want);
+        case TM_TYPE_HWHEEL:
+            return hwheel_evict(_timer, want);
+        case TM_TYPE_HEAP:
+        {
+            timer_heap_t *heap = &(_timer->timer_heap);
+            while(moved < want && heap->size > 0)
+            {
+                tmp_elem = heap->entries[0].elem;
+                heap_remove(heap, tmp_elem);
+                tmp_elem->cursor = EXPIRED_CURSOR;
+                TAILQ_INSERT_TAIL(&(_timer->expired), tmp_elem, ENTRYS);
+                moved ++;
+            }
+            return moved;
+        }
+        case TM_TYPE_MQUEUE:
+        {
+            timer_mqueue_t *mq = &(_timer->timer_mqueue);
+            while(moved < want && mq->min_class != -1)
+            {
+                tmp_elem = TAILQ_FIRST(&(mq->queues[mq->min_class]));
+                mqueue_remove(mq, tmp_elem);
+                tmp_elem->cursor = EXPIRED_CURSOR;
+                TAILQ_INSERT_TAIL(&(_timer->expired), tmp_elem, ENTRYS);
+                moved ++;
+            }
+            return moved;
+        }
+        case TM_TYPE_SWHEEL:
+            return swheel_evict(_timer, want);
+        default:
+            return 0;
+    }
+}
+
+
+/* Whether cnt more ENTRYSs, alloc of them from the pool, exceed timer's limits */
+static inline int timer_over_limit(MESA_timer_inner_t *_timer, long cnt, long alloc)
+{
+    if(_timer->max_elems > 0 && _timer->elem_cnt + cnt > _timer->max_elems)
+    {
+        return 1;
+    }
+    if(_timer->max_bytes > 0)
+    {
+        /* only a growing pool is limited, freed elements are reused */
+        long need = timer_pool_need_bytes(&(_timer->pool), alloc);
+        return need > 0 && _timer->mem_ocupy + need > _timer->max_bytes;
+    }
+    return 0;
+}
+
+
+/**
+ * Fire ENTRYSs at current_time until cnt more fit in timer's limits, evict_batch
+ * at once: deferred expired ones first, then the nearest ones before their
+ * expire. Adds by the callbacks are not limited, and when nothing is left to
+ * fire the limits are exceeded.
+ **/
+static void timer_make_room(MESA_timer_inner_t *_timer, long current_time, long cnt, long alloc)
+{
+    long before, moved;
+
+    if(_timer->evicting)
+    {
+        return;
+    }
+    _timer->evicting = 1;
+    while(timer_over_limit(_timer, cnt, alloc))
+    {
+        before = _timer->elem_cnt;
+        if(timer_fire_expired(_timer, current_time, _timer->evict_batch) < _timer->evict_batch
+           && TAILQ_EMPTY(&(_timer->expired)))
+        {
+            moved = timer_evict_nearest(_timer, _timer->evict_batch);
+            _timer->early_cnt += moved;
+            timer_fire_expired(_timer, current_time, moved);
+        }
+        if(_timer->elem_cnt >= before)
+        {
+            break;
+        }
+    }
+    _timer->evicting = 0;
+}
+
+
+
+static long long clock_read_ns(clockid_t id)
+{
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+/* TSC of a constant rate, which goes on in all C-states */
+static int tsc_invariant(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if(__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) == 0)
+        return 0;
+    return (edx & (1U << 8)) != 0;
+}
+#endif
+
+
+/* Read the clock in ticks, time never goes back */
+static long timer_clock_refresh(timer_clock_t *clock)
+{
+    long long ns;
+    long now;
+
+#if defined(__x86_64__) || defined(__i386__)
+    if(clock->mode == MESA_TIMER_CLOCK_TSC)
+    {
+        uint64_t tsc = __rdtsc();
+        double t = clock->base_ns + (double)(tsc - clock->tsc_base) * clock->ns_per_cycle;
+
+        if(tsc >= clock->tsc_calibrate)
+        {
+            /* the rate over a longer time is finer, and the offset from
+             * CLOCK_MONOTONIC is made up within the next period */
+            long long mono = clock_read_ns(CLOCK_MONOTONIC);
+            double offset = (double)mono - t;
+            clock->ns_per_cycle = (double)(mono - clock->mono_anchor) / (double)(tsc - clock->tsc_anchor);
+            clock->tsc_base = tsc;
+            clock->base_ns = t;
+            if(offset > TSC_RECALIBRATE_NS || offset < -TSC_RECALIBRATE_NS)
+            {
+                clock->base_ns = t + offset;
+            }
+            else
+            {
+                clock->ns_per_cycle += offset / (TSC_RECALIBRATE_NS / clock->ns_per_cycle);
+            }
+            clock->tsc_calibrate = tsc + (uint64_t)(TSC_RECALIBRATE_NS / clock->ns_per_cycle);
+        }
+        ns = (long long)t;
+    }
+    else
+#endif
+    {
+        ns = clock_read_ns(CLOCK_MONOTONIC_COARSE);
+    }
+    now = ns / clock->res;
+    if(now > clock->now)
+    {
+        clock->now = now;
+    }
+    return clock->now;
+}
+
+
+/* A TSC clock falls back to CLOCK_MONOTONIC_COARSE when the TSC is not invariant */
+static void timer_clock_init(timer_clock_t *clock, int mode, long res)
+{
+    clock->mode = mode;
+    clock->res = res;
+    clock->now = -1;
+    if(mode == MESA_TIMER_CLOCK_NONE)
+        return;
+
+#if defined(__x86_64__) || defined(__i386__)
+    if(mode == MESA_TIMER_CLOCK_TSC && tsc_invariant())
+    {
+        long long ns;
+        uint64_t tsc;
+
+        clock->mono_anchor = clock_read_ns(CLOCK_MONOTONIC);
+        clock->tsc_anchor = __rdtsc();
+        do
+        {
+            ns = clock_read_ns(CLOCK_MONOTONIC);
+        }while(ns - clock->mono_anchor < TSC_CALIBRATE_NS);
+        tsc = __rdtsc();
+        clock->ns_per_cycle = (double)(ns - clock->mono_anchor) / (double)(tsc - clock->tsc_anchor);
+        clock->tsc_base = tsc;
+        clock->base_ns = (double)ns;
+        clock->tsc_calibrate = tsc + (uint64_t)(TSC_RECALIBRATE_NS / clock->ns_per_cycle);
+    }
+    else
+#endif
+    {
+        clock->mode = MESA_TIMER_CLOCK_COARSE;
+    }
+    timer_clock_refresh(clock);
+}
+
+
+
+void MESA_timer_opt_init(MESA_timer_opt_t *opt)
+{
+    assert(opt != NULL);
+    opt->type = TM_TYPE_QUEUE;
+    opt->wheel_size = 0;
+    opt->prealloc_elems = 0;
+    opt->slab_elems = DEFAULT_SLAB_ELEMS;
+    opt->lazy_reset = 0;
+    opt->slack_pct = 0;
+    opt->max_elems = 0;
+    opt->max_bytes = 0;
+    opt->evict_batch = DEFAULT_EVICT_BATCH;
+    opt->auto_resize = 0;
+    opt->clock = MESA_TIMER_CLOCK_NONE;
+    opt->clock_res_ns = DEFAULT_CLOCK_RES_NS;
+}
+
+
+
+MESA_timer_t *MESA_timer_create(long wheel_size, int tm_type)
+{
+    MESA_timer_opt_t opt;
+
+    MESA_timer_opt_init(&opt);
+    opt.type = tm_type;
+    opt.wheel_size = wheel_size;
+    return MESA_timer_create_ex(&opt);
+}
+
+
+
+MESA_timer_t *MESA_timer_create_ex(const MESA_timer_opt_t *opt)
+{
+    assert(opt != NULL);
+
+    MESA_timer_inner_t *timer = NULL;
+    long wheel_size = opt->wheel_size;
+    if(opt->prealloc_elems < 0 || opt->slab_elems <= 0 || opt->slack_pct < 0
+       || opt->max_elems < 0 || opt->max_bytes < 0 || opt->evict_batch <= 0
+       || opt->clock < MESA_TIMER_CLOCK_NONE || opt->clock > MESA_TIMER_CLOCK_TSC || opt->clock_res_ns <= 0)
+    {
+        return (MESA_timer_t *)NULL;
+    }
+
+    switch(opt->type)
+    {
+        case TM_TYPE_QUEUE:
+        {
+            timer = (MESA_timer_inner_t *)calloc(1, sizeof(MESA_timer_inner_t));
+            timer->type = TM_TYPE_QUEUE;
+            timer->timer_queue.last_expire_time = -1l;
+            TAILQ_INIT(&(timer->timer_queue.queue));
+
+            timer->mem_ocupy = sizeof(MESA_timer_inner_t);
+            break;
+        }
+        case TM_TYPE_WHEEL:
+        {
+            if(wheel_size <= 0 || wheel_size > MAX_WHEEL_SIZE)
+            {
+                return (MESA_timer_t *)NULL;
+            }
+            timer = (MESA_timer_inner_t *)calloc(1, sizeof(MESA_timer_inner_t));
+            timer->type = TM_TYPE_WHEEL;
+            timer->timer_wheel.wheel_size = wheel_size;
+            timer->timer_wheel.create_time = -1;
+            timer->timer_wheel.last_check_relative_tick = -1;
+            timer->timer_wheel.spoke_index = 0;
+            timer->timer_wheel.spokes = (struct TQ *)malloc(sizeof(struct TQ) * wheel_size);
+            timer->timer_wheel.bitmap = (unsigned long *)calloc(BITMAP_WORDS(wheel_size), sizeof(unsigned long));
+
+            int i;
+            for(i = 0; i < wheel_size; i++)
+            {
+                TAILQ_INIT(&(timer->timer_wheel.spokes[i]));
+            }
+            timer->mem_ocupy = sizeof(MESA_timer_inner_t) + sizeof(struct TQ) * wheel_size
+                               + sizeof(unsigned long) * BITMAP_WORDS(wheel_size);
+
+            break;
+        }
+        case TM_TYPE_HWHEEL:
+        {
+            timer = (MESA_timer_inner_t *)calloc(1, sizeof(MESA_timer_inner_t));
+            timer->type = TM_TYPE_HWHEEL;
+            timer->timer_hwheel.current = -1;
+            timer->timer_hwheel.slots = (struct TQ *)malloc(sizeof(struct TQ) * HWHEEL_SLOTS);
+
+            int i;
+            for(i = 0; i < HWHEEL_SLOTS; i++)
+            {
+                TAILQ_INIT(&(timer->timer_hwheel.slots[i]));
+            }
+            timer->mem_ocupy = sizeof(MESA_timer_inner_t) + sizeof(struct TQ) * HWHEEL_SLOTS;
+            break;
+        }
+        case TM_TYPE_HEAP:
+        {
+            timer = (MESA_timer_inner_t *)calloc(1, sizeof(MESA_timer_inner_t));
+            timer->type = TM_TYPE_HEAP;
+            timer->mem_ocupy = sizeof(MESA_timer_inner_t);
+            heap_grow(timer);
+            break;
+        }
+        case TM_TYPE_MQUEUE:
+        {
+            if(wheel_size < 0 || wheel_size > MQUEUE_MAX_CLASSES)
+            {
+                return (MESA_timer_t *)NULL;
+            }
+            if(wheel_size == 0)
+            {
+                wheel_size = MQUEUE_DEFAULT_CLASSES;
+            }
+            timer = (MESA_timer_inner_t *)calloc(1, sizeof(MESA_timer_inner_t));
+            timer->type = TM_TYPE_MQUEUE;
+            timer_mqueue_t *mq = &(timer->timer_mqueue);
+            mq->class_max = wheel_size;
+            mq->min_class = -1;
+            mq->timeouts = (long *)malloc(sizeof(long) * wheel_size);
+            mq->head_expire = (long *)malloc(sizeof(long) * wheel_size);
+            mq->queues = (struct TQ *)malloc(sizeof(struct TQ) * wheel_size);
+
+            int i;
+            for(i = 0; i < wheel_size; i++)
+            {
+                mq->head_expire[i] = LONG_MAX;
+                TAILQ_INIT(&(mq->queues[i]));
+            }
+            timer->mem_ocupy = sizeof(MESA_timer_inner_t) + (sizeof(long) * 2 + sizeof(struct TQ)) * wheel_size;
+            break;
+        }
+        case TM_TYPE_SWHEEL:
+        {
+            if(wheel_size <= 0 || wheel_size > MAX_WHEEL_SIZE)
+            {
+                return (MESA_timer_t *)NULL;
+            }
+            timer = (MESA_timer_inner_t *)calloc(1, sizeof(MESA_timer_inner_t));
+            timer->type = TM_TYPE_SWHEEL;
+            timer_swheel_t *sw = &(timer->timer_swheel);
+            sw->wheel.wheel_size = wheel_size;
+            sw->wheel.create_time = -1;
+            sw->wheel.last_check_relative_tick = -1;
+            sw->wheel.spoke_index = 0;
+            sw->wheel.bitmap = (unsigned long *)calloc(BITMAP_WORDS(wheel_size), sizeof(unsigned long));
+            sw->spokes = (timer_swheel_spoke_t *)calloc(wheel_size, sizeof(timer_swheel_spoke_t));
+            sw->scan = swheel_select_scan();
+            timer->mem_ocupy = sizeof(MESA_timer_inner_t) + sizeof(timer_swheel_spoke_t) * wheel_size
+                               + sizeof(unsigned long) * BITMAP_WORDS(wheel_size);
+            break;
+        }
+        default:
+            return (MESA_timer_t *)NULL;
+    }
+
+    TAILQ_INIT(&(timer->expired));
+    timer->elem_cnt = 0;
+    timer->lazy_reset = opt->lazy_reset;
+    timer->max_elems = opt->max_elems;
+    timer->max_bytes = opt->max_bytes;
+    timer->evict_batch = opt->evict_batch;
+    timer->auto_resize = opt->type == TM_TYPE_WHEEL && opt->auto_resize;
+    timer_clock_init(&(timer->clock), opt->clock, opt->clock_res_ns);
+    /* a queue needs exact expire order, a multi-class queue exact timeouts */
+    if(opt->type != TM_TYPE_QUEUE && opt->type != TM_TYPE_MQUEUE)
+    {
+        timer->slack_pct = opt->slack_pct;
+    }
+    timer_pool_init(timer, opt->slab_elems);
+    while(timer->pool.slab_cnt * timer->pool.slab_elems < opt->prealloc_elems)
+    {
+        timer_pool_grow(timer);
+    }
+
+    return (MESA_timer_t *)timer;
+}
+
+
+
+/**
+ * free_cb of the event of elem when destroying timer. The element goes back
+ * with its slab, a node outlives timer and may be added again.
+ **/
+static inline void timer_free_event(timer_elem_t *elem)
+{
+    elem->status = NOT_IN_TIMER;
+    if(elem->free_cb != NULL)
+    {
+        elem->free_cb(elem->event);
+    }
+}
+
+
+/* free_cb of every event in queue */
+static void timer_free_queue(struct TQ *queue)
+{
+    timer_elem_t *tmp_elem;
+    TAILQ_FOREACH(tmp_elem, queue, ENTRYS)
+    {
+        timer_free_event(tmp_elem);
+    }
+}
+
+
+
+void MESA_timer_destroy(MESA_timer_t *timer)
+{
+    assert(timer != NULL);
+
+    MESA_timer_inner_t *_timer = (MESA_timer_inner_t *)timer;
+    timer_drain_done(_timer, -1);
+    switch(_timer->type)
+    {
+        case TM_TYPE_QUEUE:
+        {
+            timer_free_queue(&(_timer->timer_queue.queue));
+            break;
+        }
+        case TM_TYPE_WHEEL:
+        {
+            int i;
+            for(i = 0; i < _timer->timer_wheel.wheel_size; i++)
+            {
+                timer_free_queue(&(_timer->timer_wheel.spokes[i]));
+            }
+            for(i = 0; i < _timer->timer_wheel.old_size; i++)
+            {
+                timer_free_queue(&(_timer->timer_wheel.old_spokes[i]));
+            }
+            free(_timer->timer_wheel.spokes);
+            free(_timer->timer_wheel.bitmap);
+            free(_timer->timer_wheel.old_spokes);
+            free(_timer->timer_wheel.old_bitmap);
+            break;
+        }
+        case TM_TYPE_HWHEEL:
+        {
+            int i;
+            for(i = 0; i < HWHEEL_SLOTS; i++)
+            {
+                timer_free_queue(&(_timer->timer_hwheel.slots[i]));
+            }
+            free(_timer->timer_hwheel.slots);
+            break;
+        }
+        case TM_TYPE_HEAP:
+        {
+            timer_heap_t *heap = &(_timer->timer_heap);
+            long i;
+            for(i = 0; i < heap->size; i++)
+            {
+                timer_free_event(heap->entries[i].elem);
+            }
+            free(heap->entries - HEAP_PAD);
+            break;
+        }
+        case TM_TYPE_MQUEUE:
+        {
+            timer_mqueue_t *mq = &(_timer->timer_mqueue);
+            int i;
+            for(i = 0; i < mq->class_cnt; i++)
+            {
+                timer_free_queue(&(mq->queues[i]));
+            }
+            free(mq->timeouts);
+            free(mq->head_expire);
+            free(mq->queues);
+            break;
+        }
+        case TM_TYPE_SWHEEL:
+        {
+            timer_swheel_t *sw = &(_timer->timer_swheel);
+            long i;
+            int j;
+            for(i = 0; i < sw->wheel.wheel_size; i++)
+            {
+                timer_swheel_spoke_t *spoke = &(sw->spokes[i]);
+                for(j = 0; j < spoke->cnt; j++)
+                {
+                    timer_free_event(spoke->elems[j]);
+                }
+                free(spoke->rotations);
+                free(spoke->elems);
+            }
+            free(sw->spokes);
+            free(sw->wheel.bitmap);
+            free(sw->due);
+            break;
+        }
+        default:
+            break;
+    }
+    timer_free_queue(&(_timer->expired));
+    timer_pool_destroy(&(_timer->pool));
+    free(timer);
+    return;
+}
+
+
+
+/**
+ * Delay current_time + timeout by at most slack ticks to the time with the
+ * most trailing zero bits in range, so that close deadlines fall on one.
+ * Return the delayed timeout, or timeout when timer's type takes no slack.
+ **/
+static inline long timer_apply_slack(MESA_timer_inner_t *_timer, long current_time, long timeout, long slack)
+{
+    long expire = current_time + timeout, limit = expire + slack, mask;
+
+    if(slack <= 0 || _timer->type == TM_TYPE_QUEUE || _timer->type == TM_TYPE_MQUEUE)
+    {
+        return timeout;
+    }
+    /* keep the bits above the highest one changed by adding slack */
+    mask = (1L << (63 - __builtin_clzl(expire ^ limit))) - 1;
+    return (limit & ~mask) - current_time;
+}
+
+
+/* Apply timer's own slack to timeout */
+static inline long timer_slack(MESA_timer_inner_t *_timer, long current_time, long timeout)
+{
+    if(_timer->slack_pct == 0)
+    {
+        return timeout;
+    }
+    return timer_apply_slack(_timer, current_time, timeout, timeout / 100 * _timer->slack_pct
+                                                           + timeout % 100 * _timer->slack_pct / 100);
+}
+
+
+/**
+ * File elem, whose callbacks and event are set, into timer at
+ * current_time + timeout. Return 0, or -1 when timer refuses it.
+ **/
+static int timer_insert_elem(MESA_timer_inner_t *_timer, long current_time, long timeout, timer_elem_t *elem)
+{
+    switch(_timer->type)
+    {
+        case TM_TYPE_QUEUE:
+        {
+            long expire = current_time + timeout;
+            if(expire < _timer->timer_queue.last_expire_time)
+            {
+                return -1;
+            }
+            _timer->timer_queue.last_expire_time = expire;
+
+            elem->expire = expire;
+            /* insert a timer ENTRYS to tail of timer queue */
+            elem->cursor = 0;
+            TAILQ_INSERT_TAIL(&(_timer->timer_queue.queue), elem, ENTRYS);
+            elem->status= IN_TIMER;
+
+            _timer->elem_cnt += 1;
+            return 0;
+        }
+        case TM_TYPE_WHEEL:
+        {
+            timer_wheel_t *wheel = &(_timer->timer_wheel);
+
+            /* the first timer ENTRYS start the timer, and current_time's relative time is 0 */
+            if(wheel->last_check_relative_tick == -1)
+            {
+                wheel->create_time = current_time;
+                wheel->spoke_index = 0;
+                wheel->last_check_relative_tick = 0;
+            }
+
+            elem->expire = current_time + timeout;
+            wheel_tune_sample(_timer, timeout);
+
+            /* insert a timer ENTRYS to tail of its spoke */
+            wheel_insert(wheel, elem);
+            elem->status = IN_TIMER;
+
+            /* update stat data */
+            _timer->elem_cnt += 1;
+            return 0;
+        }
+        case TM_TYPE_HWHEEL:
+        {
+            timer_hwheel_t *hw = &(_timer->timer_hwheel);
+
+            /* the first timer ENTRYS start the timer at current_time */
+            if(hw->current == -1)
+            {
+                hw->current = current_time;
+            }
+
+            elem->expire = current_time + timeout;
+
+            hwheel_insert(_timer, elem);
+            elem->status = IN_TIMER;
+
+            _timer->elem_cnt += 1;
+            return 0;
+        }
+        case TM_TYPE_HEAP:
+        {
+            elem->expire = current_time + timeout;
+
+            heap_insert(_timer, elem);
+            elem->status = IN_TIMER;
+
+            _timer->elem_cnt += 1;
+            return 0;
+        }
+        case TM_TYPE_MQUEUE:
+        {
+            timer_mqueue_t *mq = &(_timer->timer_mqueue);
+            int cls = mqueue_class(mq, timeout, 1);
+            if(cls == -1)
+            {
+                return -1;
+            }
+
+            elem->expire = current_time + timeout;
+
+            mqueue_insert(mq, elem, cls);
+            elem->status = IN_TIMER;
+
+            _timer->elem_cnt += 1;
+            return 0;
+        }
+        case TM_TYPE_SWHEEL:
+        {
+            timer_wheel_t *wheel = &(_timer->timer_swheel.wheel);
+
+            /* the first timer ENTRYS start the timer, and current_time's relative time is 0 */
+            if(wheel->last_check_relative_tick == -1)
+            {
+                wheel->create_time = current_time;
+                wheel->spoke_index = 0;
+                wheel->last_check_relative_tick = 0;
+            }
+
+            elem->expire = current_time + timeout;
+
+            swheel_insert(_timer, elem);
+            elem->status = IN_TIMER;
+
+            _timer->elem_cnt += 1;
+            return 0;
+        }
+        default:
+            return -1;
+    }
+}
+
+
+
+int MESA_timer_add(MESA_timer_t *timer, 
+                   long current_time, 
+                   long timeout,
+                   timeout_cb_t timeout_cb,
+                   void *event, 
+                   event_free_cb_t free_cb,
+                   MESA_timer_index_t **index)
+{
+    assert(timer != 0 && current_time >= 0 && timeout >= 0);
+
+    MESA_timer_inner_t *_timer = (MESA_timer_inner_t *)timer;
+    timer_elem_t *elem;
+
+    timer_make_room(_timer, current_time, 1, 1);
+    elem = timer_pool_alloc(_timer);
+    elem->timeout_cb = timeout_cb;
+    elem->event = event;
+    elem->free_cb = free_cb;
+
+    if(timer_insert_elem(_timer, current_time, timer_slack(_timer, current_time, timeout), elem) != 0)
+    {
+        timer_pool_free(_timer, elem);
+        *index = NULL;
+        return -1;
+    }
+    TRACE(_timer, MESA_TIMER_TRACE_ADD, elem->id, current_time, timeout, -1, 0);
+    STATS_ADD(_timer, add_cnt, 1);
+    *index = (MESA_timer_index_t *)elem;
+    return 0;
+}
+
+
+
+int MESA_timer_add_slack(MESA_timer_t *timer,
+                         long current_time,
+                         long timeout,
+                         long slack,
+                         timeout_cb_t timeout_cb,
+                         void *event,
+                         event_free_cb_t free_cb,
+                         MESA_timer_index_t **index)
+{
+    assert(timer != 0 && current_time >= 0 && timeout >= 0 && slack >= 0);
+
+    MESA_timer_inner_t *_timer = (MESA_timer_inner_t *)timer;
+    timer_elem_t *elem;
+
+    timer_make_room(_timer, current_time, 1, 1);
+    elem = timer_pool_alloc(_timer);
+    elem->timeout_cb = timeout_cb;
+    elem->event = event;
+    elem->free_cb = free_cb;
+
+    if(timer_insert_elem(_timer, current_time, timer_apply_slack(_timer, current_time, timeout, slack), elem) != 0)
+    {
+        timer_pool_free(_timer, elem);
+        *index = NULL;
+        return -1;
+    }
+    TRACE(_timer, MESA_TIMER_TRACE_ADD, elem->id, current_time, timeout, slack, 0);
+    STATS_ADD(_timer, add_cnt, 1);
+    *index = (MESA_timer_index_t *)elem;
+    return 0;
+}
+
+
+
+int MESA_timer_add_periodic(MESA_timer_t *timer,
+                            long current_time,
+                            long first,
+                            long interval,
+                            int flags,
+                            timeout_cb_t timeout_cb,
+                            void *event,
+                            event_free_cb_t free_cb,
+                            MESA_timer_index_t **index)
+{
+    assert(timer != 0 && current_time >= 0 && first >= 0 && interval > 0);
+
+    MESA_timer_inner_t *_timer = (MESA_timer_inner_t *)timer;
+    timer_elem_t *elem;
+
+    if(_timer->type == TM_TYPE_MQUEUE && !mqueue_periodic_fits(&(_timer->timer_mqueue), first, interval))
+    {
+        *index = NULL;
+        return -1;
+    }
+
+    timer_make_room(_timer, current_time, 1, 1);
+    elem = timer_pool_alloc(_timer);
+    elem->timeout_cb = timeout_cb;
+    elem->event = event;
+    elem->free_cb = free_cb;
+
+    /* no slack, the schedule is kept by the interval */
+    if(timer_insert_elem(_timer, current_time, first, elem) != 0)
+    {
+        timer_pool_free(_timer, elem);
+        *index = NULL;
+        return -1;
+    }
+    timer_set_periodic(_timer, elem, interval, flags);
+    TRACE(_timer, MESA_TIMER_TRACE_ADD_PERIODIC, elem->id, current_time, first, interval, flags);
+    STATS_ADD(_timer, add_cnt, 1);
+    *index = (MESA_timer_index_t *)elem;
+    return 0;
+}
+
+
+
+int MESA_timer_add_node(MESA_timer_t *timer,
+                        long current_time,
+                        long timeout,
+                        timeout_cb_t timeout_cb,
+                        MESA_timer_node_t *node)
+{
+    assert(timer != 0 && node != NULL && current_time >= 0 && timeout >= 0);
+
+    MESA_timer_inner_t *_timer = (MESA_timer_inner_t *)timer;
+    timer_elem_t *elem = (timer_elem_t *)node;
+
+    /* relinking a filed node would corrupt its spoke or list */
+    if(elem->status == IN_TIMER)
+    {
+        return -1;
+    }
+
+    timer_make_room(_timer, current_time, 1, 0);
+    elem->flags = ELEM_FLAG_NODE;
+    elem->timeout_cb = timeout_cb;
+    elem->event = node;
+    elem->free_cb = NULL;
+    elem->status = NOT_IN_TIMER;
+
+    if(timer_insert_elem(_timer, current_time, timer_slack(_timer, current_time, timeout), elem) != 0)
+    {
+        return -1;
+    }
+    STATS_ADD(_timer, add_cnt, 1);
+    return 0;
+}
+
+
+
+long MESA_timer_del_node(MESA_timer_t *timer, MESA_timer_node_t *node)
+{
+    return MESA_timer_del(timer, (MESA_timer_index_t *)node);
+}
+
+
+
+int MESA_timer_reset_node(MESA_timer_t *timer, MESA_timer_node_t *node, long current_time, long timeout)
+{
+    return MESA_timer_reset(timer, (MESA_timer_index_t *)node, current_time, timeout);
+}
+
+
+
+int MESA_timer_add_h(MESA_timer_t *timer,
+                     long current_time,
+                     long timeout,
+                     timeout_cb_t timeout_cb,
+                     void *event,
+                     event_free_cb_t free_cb,
+                     MESA_timer_handle_t *handle)
+{
+    assert(timer != 0 && current_time >= 0 && timeout >= 0);
+
+    MESA_timer_inner_t *_timer = (MESA_timer_inner_t *)timer;
+    timer_elem_t *elem;
+
+    timer_make_room(_timer, current_time, 1, 1);
+    elem = timer_pool_alloc(_timer);
+    elem->timeout_cb = timeout_cb;
+    elem->event = event;
+    elem->free_cb = free_cb;
+
+    if(elem->id >= HANDLE_MAX_ELEMS || timer_insert_elem(_timer, current_time, timer_slack(_timer, current_time, timeout), elem) != 0)
+    {
+        timer_pool_free(_timer, elem);
+        *handle = MESA_TIMER_HANDLE_INVALID;
+        return -1;
+    }
+    TRACE(_timer, MESA_TIMER_TRACE_ADD, elem->id, current_time, timeout, -1, 0);
+    STATS_ADD(_timer, add_cnt, 1);
+    *handle = timer_pool_handle(elem);
+    return 0;
+}
+
+
+
+long MESA_timer_del_h(MESA_timer_t *timer, MESA_timer_handle_t handle)
+{
+    assert(timer != NULL);
+
+    timer_elem_t *elem = timer_pool_lookup(&(((MESA_timer_inner_t *)timer)->pool), handle);
+    if(elem == NULL)
+    {
+        return -1;
+    }
+    return MESA_timer_del(timer, (MESA_timer_index_t *)elem);
+}
+
+
+
+int MESA_timer_reset_h(MESA_timer_t *timer, MESA_timer_handle_t handle, long current_time, long timeout)
+{
+    assert(timer != NULL);
+
+    timer_elem_t *elem = timer_pool_lookup(&(((MESA_timer_inner_t *)timer)->pool), handle);
+    if(elem == NULL)
+    {
+        return -1;
+    }
+    return MESA_timer_reset(timer, (MESA_timer_index_t *)elem, current_time, timeout);
+}
+
+
+
+static inline timer_elem_t *timer_batch_elem(MESA_timer_inner_t *_timer,
+                                             long expire,
+                                             timeout_cb_t timeout_cb,
+                                             void *event,
+                                             event_free_cb_t free_cb)
+{
+    timer_elem_t *elem = timer_pool_alloc(_timer);
+    elem->expire = expire;
+    elem->timeout_cb = timeout_cb;
+
+    elem->event = event;
+    elem->free_cb = free_cb;
+    elem->status = IN_TIMER;
+    return elem;
+}
+
+
+
+long MESA_timer_add_batch(MESA_timer_t *timer,
+                          long current_time,
+                          long n,
+                          const long *timeouts,
+                          void **events,
+                          timeout_cb_t timeout_cb,
+                          event_free_cb_t free_cb,
+                          MESA_timer_index_t **indexes)
+{
+    assert(timer != NULL && current_time >= 0 && n >= 0);
+
+    MESA_timer_inner_t *_timer = (MESA_timer_inner_t *)timer;
+    timer_elem_t *elem;
+    long i, added = 0;
+
+    timer_make_room(_timer, current_time, n, n);
+    switch(_timer->type)
+    {
+        case TM_TYPE_QUEUE:
+        {
+            timer_queue_t *queue = &(_timer->timer_queue);
+            for(i = 0; i < n; i++)
+            {
+                long expire = current_time + timeouts[i];
+                if(expire < queue->last_expire_time)
+                {
+                    indexes[i] = NULL;
+                    continue;
+                }
+                queue->last_expire_time = expire;
+
+                elem = timer_batch_elem(_timer, expire, timeout_cb, events[i], free_cb);
+                elem->cursor = 0;
+                TAILQ_INSERT_TAIL(&(queue->queue), elem, ENTRYS);
+                indexes[i] = (MESA_timer_index_t *)elem;
+                added ++;
+            }
+            break;
+        }
+        case TM_TYPE_WHEEL:
+        {
+            timer_wheel_t *wheel = &(_timer->timer_wheel);
+
+            /* the first timer ENTRYS start the timer, and current_time's relative time is 0 */
+            if(wheel->last_check_relative_tick == -1)
+            {
+                wheel->create_time = current_time;
+                wheel->spoke_index = 0;
+                wheel->last_check_relative_tick = 0;
+            }
+
+            /* the same as wheel_insert, but spoke and rotation are computed
+             * once for a run of equal timeouts */
+            long base = current_time - wheel->create_time - wheel->last_check_relative_tick;
+            long last_timeout = -1, timeout = 0, cursor = 0;
+            int rotation_cnt = 0;
+            for(i = 0; i < n; i++)
+            {
+                if(timeouts[i] != last_timeout)
+                {
+                    timeout = timer_slack(_timer, current_time, timeouts[i]);
+                    long distance = base + timeout;
+                    if(distance < 0)
+                    {
+                        distance = 0;
+                    }
+                    rotation_cnt = distance / wheel->wheel_size;
+                    cursor = (wheel->spoke_index + distance % wheel->wheel_size) % wheel->wheel_size;
+                    last_timeout = timeouts[i];
+                    bitmap_set(wheel->bitmap, cursor);
+                }
+
+                elem = timer_batch_elem(_timer, current_time + timeout, timeout_cb, events[i], free_cb);
+                elem->rotation_cnt = rotation_cnt;
+                elem->cursor = cursor;
+                elem->flags |= wheel->epoch;
+                TAILQ_INSERT_TAIL(&(wheel->spokes[cursor]), elem, ENTRYS);
+                wheel_tune_sample(_timer, timeout);
+                indexes[i] = (MESA_timer_index_t *)elem;
+            }
+            added = n;
+            break;
+        }
+        case TM_TYPE_HWHEEL:
+        {
+            timer_hwheel_t *hw = &(_timer->timer_hwheel);
+
+            /* the first timer ENTRYS start the timer at current_time */
+            if(hw->current == -1)
+            {
+                hw->current = current_time;
+            }
+            for(i = 0; i < n; i++)
+            {
+                elem = timer_batch_elem(_timer, current_time + timer_slack(_timer, current_time, timeouts[i]), timeout_cb, events[i], free_cb);
+                hwheel_insert(_timer, elem);
+                indexes[i] = (MESA_timer_index_t *)elem;
+            }
+            added = n;
+            break;
+        }
+        case TM_TYPE_HEAP:
+        {
+            for(i = 0; i < n; i++)
+            {
+                elem = timer_batch_elem(_timer, current_time + timer_slack(_timer, current_time, timeouts[i]), timeout_cb, events[i], free_cb);
+                heap_insert(_timer, elem);
+                indexes[i] = (MESA_timer_index_t *)elem;
+            }
+            added = n;
+            break;
+        }
+        case TM_TYPE_MQUEUE:
+        {
+            timer_mqueue_t *mq = &(_timer->timer_mqueue);
+            for(i = 0; i < n; i++)
+            {
+                int cls = mqueue_class(mq, timeouts[i], 1);
+                if(cls == -1)
+                {
+                    indexes[i] = NULL;
+                    continue;
+                }
+                elem = timer_batch_elem(_timer, current_time + timeouts[i], timeout_cb, events[i], free_cb);
+                mqueue_insert(mq, elem, cls);
+                indexes[i] = (MESA_timer_index_t *)elem;
+                added ++;
+            }
+            break;
+        }
+        case TM_TYPE_SWHEEL:
+        {
+            timer_wheel_t *wheel = &(_timer->timer_swheel.wheel);
+
+            /* the first timer ENTRYS start the timer, and current_time's relative time is 0 */
+            if(wheel->last_check_relative_tick == -1)
+            {
+                wheel->create_time = current_time;
+                wheel->spoke_index = 0;
+                wheel->last_check_relative_tick = 0;
+            }
+            for(i = 0; i < n; i++)
+            {
+                elem = timer_batch_elem(_timer, current_time + timer_slack(_timer, current_time, timeouts[i]), timeout_cb, events[i], free_cb);
+                swheel_insert(_timer, elem);
+                indexes[i] = (MESA_timer_index_t *)elem;
+            }
+            added = n;
+            break;
+        }
+        default:
+        {
+            for(i = 0; i < n; i++)
+            {
+                indexes[i] = NULL;
+            }
+            return -1;
+        }
+    }
+
+    _timer->elem_cnt += added;
+    STATS_ADD(_timer, add_cnt, added);
+    if(_timer->trace != NULL)
+    {
+        for(i = 0; i < n; i++)
+        {
+            if(indexes[i] != NULL)
+            {
+                timer_trace(_timer, MESA_TIMER_TRACE_ADD, ((timer_elem_t *)indexes[i])->id, current_time, timeouts[i], -1, 0);
+            }
+        }
+    }
+    return added;
+}
+
+
+
+long MESA_timer_del(MESA_timer_t *timer, MESA_timer_index_t* index)
+{
+    assert(timer != NULL && index != NULL);
+
+    MESA_timer_inner_t *_timer = (MESA_timer_inner_t *)timer;
+    timer_elem_t *elem = (timer_elem_t *)index;
+
+    if(!(elem->flags & ELEM_FLAG_NODE))
+    {
+        TRACE(_timer, MESA_TIMER_TRACE_DEL, elem->id, -1, 0, 0, 0);
+    }
+    if(elem->status != IN_TIMER)
+    {
+        /* a periodic ENTRYS whose callback is running is released after it */
+        if((elem->flags & ELEM_FLAG_PERIODIC) && (elem == _timer->firing || elem->status == IN_FLIGHT))
+        {
+            elem->flags |= ELEM_FLAG_STOPPED;
+            return elem->expire;
+        }
+        return -1;
+    }
+
+    long ret_timeout = -1;
+    switch(_timer->type)
+    {
+        case TM_TYPE_QUEUE:
+        {
+            ret_timeout = elem->expire;
+            /* remove from timer queue */
+            if(elem->cursor == EXPIRED_CURSOR)
+            {
+                TAILQ_REMOVE(&(_timer->expired), elem, ENTRYS);
+            }
+            else
+            {
+                TAILQ_REMOVE(&(_timer->timer_queue.queue), elem, ENTRYS);
+            }
+            elem->status = NOT_IN_TIMER;
+
+            _timer->elem_cnt --;
+
+            /* update timer queue's last_expire_time */
+            if(!TAILQ_EMPTY(&(_timer->timer_queue.queue)))
+            {
+                timer_elem_t *tail = TAILQ_LAST(&(_timer->timer_queue.queue), TQ);
+                _timer->timer_queue.last_expire_time = tail->expire;
+            }
+            else
+            {
+                _timer->timer_queue.last_expire_time = -1;
+            }
+
+            if(elem->free_cb != NULL)
+            {
+                elem->free_cb(elem->event);
+            }
+            timer_elem_release(_timer, elem);
+            break;
+        }
+        case TM_TYPE_WHEEL:
+        {
+            ret_timeout = elem->expire;
+            if(elem->cursor == EXPIRED_CURSOR)
+            {
+                TAILQ_REMOVE(&(_timer->expired), elem, ENTRYS);
+            }
+            else
+            {
+                wheel_remove(&(_timer->timer_wheel), elem);
+            }
+            elem->status = NOT_IN_TIMER;
+
+            _timer->elem_cnt --;
+
+            if(elem->free_cb != NULL)
+            {
+                elem->free_cb(elem->event);
+            }
+            timer_elem_release(_timer, elem);
+            break;
+        }
+        case TM_TYPE_HWHEEL:
+        {
+            ret_timeout = elem->expire;
+            if(elem->cursor == EXPIRED_CURSOR)
+            {
+                TAILQ_REMOVE(&(_timer->expired), elem, ENTRYS);
+            }
+            else
+            {
+                hwheel_remove(&(_timer->timer_hwheel), elem);
+            }
+            elem->status = NOT_IN_TIMER;
+
+            _timer->elem_cnt --;
+
+            if(elem->free_cb != NULL)
+            {
+                elem->free_cb(elem->event);
+            }
+            timer_elem_release(_timer, elem);
+            break;
+        }
+        case TM_TYPE_HEAP:
+        {
+            ret_timeout = elem->expire;
+            if(elem->cursor == EXPIRED_CURSOR)
+            {
+                TAILQ_REMOVE(&(_timer->expired), elem, ENTRYS);
+            }
+            else
+            {
+                heap_remove(&(_timer->timer_heap), elem);
+            }
+            elem->status = NOT_IN_TIMER;
+
+            _timer->elem_cnt --;
+
+            if(elem->free_cb != NULL)
+            {
+                elem->free_cb(elem->event);
+            }
+            timer_elem_release(_timer, elem);
+            break;
+        }
+        case TM_TYPE_MQUEUE:
+        {
+            ret_timeout = elem->expire;
+            if(elem->cursor == EXPIRED_CURSOR)
+            {
+                TAILQ_REMOVE(&(_timer->expired), elem, ENTRYS);
+            }
+            else
+            {
+                mqueue_remove(&(_timer->timer_mqueue), elem);
+            }
+            elem->status = NOT_IN_TIMER;
+
+            _timer->elem_cnt --;
+
+            if(elem->free_cb != NULL)
+            {
+                elem->free_cb(elem->event);
+            }
+            timer_elem_release(_timer, elem);
+            break;
+        }
+        case TM_TYPE_SWHEEL:
+        {
+            ret_timeout = elem->expire;
+            if(elem->cursor == EXPIRED_CURSOR)
+            {
+                TAILQ_REMOVE(&(_timer->expired), elem, ENTRYS);
+            }
+            else
+            {
+                swheel_remove(&(_timer->timer_swheel), elem);
+            }
+            elem->status = NOT_IN_TIMER;
+
+            _timer->elem_cnt --;
+
+            if(elem->free_cb != NULL)
+            {
+                elem->free_cb(elem->event);
+            }
+            timer_elem_release(_timer, elem);
+            break;
+        }
+        default:
+            return -1;
+    }
+    STATS_ADD(_timer, del_cnt, 1);
+    return ret_timeout;
+}
+
+
+
+#ifndef MESA_TIMER_NO_STATS
+/* Whether an ENTRYS of queue has expired by current_time */
+static int timer_list_due(struct TQ *queue, long current_time)
+{
+    timer_elem_t *tmp_elem;
+
+    TAILQ_FOREACH(tmp_elem, queue, ENTRYS)
+    {
+        if(tmp_elem->expire <= current_time)
+            return 1;
+    }
+    return 0;
+}
+
+
+/**
+ * Whether a check which used up its budget left due events behind. The next
+ * expire of the wheels is a lower bound only, their ENTRYSs may wait for
+ * later rotations or levels, so the spokes and slots a check would pass by
+ * current_time are looked into.
+ **/
+static int timer_due_left(MESA_timer_t *timer, long current_time)
+{
+    MESA_timer_inner_t *_timer = (MESA_timer_inner_t *)timer;
+    long next, distance, tickcnt, spoke, i;
+
+    if(!TAILQ_EMPTY(&(_timer->expired)))
+        return 1;
+
+    switch(_timer->type)
+    {
+        case TM_TYPE_WHEEL:
+        case TM_TYPE_SWHEEL:
+        {
+            timer_wheel_t *wheel = _timer->type == TM_TYPE_WHEEL ? &(_timer->timer_wheel) : &(_timer->timer_swheel.wheel);
+            if(wheel->create_time == -1)
+                return 0;
+
+            tickcnt = current_time - wheel->create_time - wheel->last_check_relative_tick;
+            if(tickcnt > wheel->wheel_size)
+                tickcnt = wheel->wheel_size;
+            for(distance = 0; distance < tickcnt; distance++)
+            {
+                spoke = (wheel->spoke_index + distance) % wheel->wheel_size;
+                if(_timer->type == TM_TYPE_WHEEL)
+                {
+                    if(timer_list_due(&(wheel->spokes[spoke]), current_time))
+                        return 1;
+                    continue;
+                }
+                timer_swheel_spoke_t *sw_spoke = &(_timer->timer_swheel.spokes[spoke]);
+                for(i = 0; i < sw_spoke->cnt; i++)
+                {
+                    if(sw_spoke->elems[i]->expire <= current_time)
+                        return 1;
+                }
+            }
+            return 0;
+        }
+        case TM_TYPE_HWHEEL:
+        {
+            timer_hwheel_t *hw = &(_timer->timer_hwheel);
+            long block, last;
+            int level, shift = HWHEEL_L0_BITS;
+
+            if(hw->current == -1)
+                return 0;
+
+            /* level 0 slots of the ticks up to current_time */
+            last = current_time < hw->current + HWHEEL_L0_MASK ? current_time : hw->current + HWHEEL_L0_MASK;
+            for(i = hw->current; i <= last; i++)
+            {
+                if(timer_list_due(&(hw->slots[i & HWHEEL_L0_MASK]), current_time))
+                    return 1;
+            }
+            /* upper slots whose boundaries are up to current_time */
+            for(level = 1; level < HWHEEL_LEVELS; level++, shift += HWHEEL_LN_BITS)
+            {
+                block = (hw->current + (1L << shift) - 1) >> shift;
+                last = current_time >> shift;
+                if(last - block > HWHEEL_LN_MASK)
+                    last = block + HWHEEL_LN_MASK;
+                for(; block <= last; block++)
+                {
+                    if(timer_list_due(&(hw->slots[HWHEEL_L0_SIZE + (level - 1) * HWHEEL_LN_SIZE + (block & HWHEEL_LN_MASK)]),
+                                      current_time))
+                        return 1;
+                }
+            }
+            return 0;
+        }
+        default:
+            next = MESA_timer_next_expire(timer);
+            return next != -1 && next <= current_time;
+    }
+}
+#endif
+
+
+
+long MESA_timer_check(MESA_timer_t *timer, long current_time, long max_cb_times)
+{
+    assert(timer != NULL && current_time >= 0 && max_cb_times >= 0);
+
+    long cb_cnt = 0;
+    MESA_timer_inner_t *_timer = (MESA_timer_inner_t *)timer;
+
+    /* expired ENTRYS deferred by max_cb_times are fired first */
+    STATS_ADD(_timer, check_cnt, 1);
+    TRACE(_timer, MESA_TIMER_TRACE_CHECK, 0, current_time, max_cb_times, 0, MESA_TIMER_TRACE_CHECK_CB);
+    timer_drain_done(_timer, current_time);
+    cb_cnt = timer_fire_expired(_timer, current_time, max_cb_times);
+    if(!TAILQ_EMPTY(&(_timer->expired)))
+    {
+        STATS_ADD(_timer, deferred_cnt, 1);
+        return cb_cnt;
+    }
+
+    if(timer_gather_expired(_timer, current_time, max_cb_times - cb_cnt) < 0)
+        return -1;
+    cb_cnt += timer_fire_expired(_timer, current_time, max_cb_times - cb_cnt);
+#ifndef MESA_TIMER_NO_STATS
+    if(cb_cnt == max_cb_times && timer_due_left(timer, current_time))
+    {
+        STATS_ADD(_timer, deferred_cnt, 1);
+    }
+#endif
+    return cb_cnt;
+}
+
+
+
+long MESA_timer_check_collect(MESA_timer_t *timer, long current_time, MESA_timer_expired_t *expired, long max_cnt)
+{
+    assert(timer != NULL && current_time >= 0 && max_cnt >= 0);
+
+    long cnt = 0;
+    MESA_timer_inner_t *_timer = (MESA_timer_inner_t *)timer;
+    timer_elem_t *tmp_elem, *tmp;
+    struct TQ rearm;
+
+    STATS_ADD(_timer, check_cnt, 1);
+    TRACE(_timer, MESA_TIMER_TRACE_CHECK, 0, current_time, max_cnt, 0, MESA_TIMER_TRACE_CHECK_COLLECT);
+    TAILQ_INIT(&rearm);
+    timer_drain_done(_timer, current_time);
+    while(cnt < max_cnt)
+    {
+        /* ENTRYS left by the last call go first, no callback adds ENTRYS here,
+         * so gather until max_cnt is reached or nothing is due */
+        if(TAILQ_EMPTY(&(_timer->expired)))
+        {
+            long moved = timer_gather_expired(_timer, current_time, max_cnt - cnt);
+            if(moved < 0)
+                return -1;
+            if(moved == 0)
+                break;
+        }
+
+        /* prefetch two ENTRYS ahead and the event of the next one, so that
+         * the caller's loop over expired finds events in cache */
+        tmp_elem = TAILQ_FIRST(&(_timer->expired));
+        PREFETCH(TAILQ_NEXT(tmp_elem, ENTRYS));
+        PREFETCH(tmp_elem->event);
+        while(cnt < max_cnt && tmp_elem != NULL)
+        {
+            tmp = TAILQ_NEXT(tmp_elem, ENTRYS);
+            if(tmp != NULL)
+            {
+                PREFETCH(TAILQ_NEXT(tmp, ENTRYS));
+                PREFETCH(tmp->event);
+            }
+
+            TAILQ_REMOVE(&(_timer->expired), tmp_elem, ENTRYS);
+            tmp_elem->status = NOT_IN_TIMER;
+            expired[cnt].event = tmp_elem->event;
+            expired[cnt].timeout_cb = tmp_elem->timeout_cb;
+            expired[cnt].free_cb = tmp_elem->free_cb;
+            STATS_HIST(_timer, lateness_hist, current_time - tmp_elem->expire);
+            /* a periodic ENTRYS keeps its event, it is filed again after the loop
+             * so that one call does not collect it twice, cursor keeps its
+             * slot in expired until then */
+            if(timer_rearm_wanted(_timer, tmp_elem))
+            {
+                expired[cnt].free_cb = NULL;
+                tmp_elem->cursor = cnt;
+                TAILQ_INSERT_TAIL(&rearm, tmp_elem, ENTRYS);
+            }
+            else
+            {
+                timer_elem_release(_timer, tmp_elem);
+            }
+
+            _timer->elem_cnt --;
+            cnt ++;
+            tmp_elem = tmp;
+        }
+    }
+    while((tmp_elem = TAILQ_FIRST(&rearm)) != NULL)
+    {
+        TAILQ_REMOVE(&rearm, tmp_elem, ENTRYS);
+        /* not filed again, the caller frees the event after its callback */
+        if(timer_rearm(_timer, tmp_elem, current_time) != 0)
+        {
+            expired[tmp_elem->cursor].free_cb = tmp_elem->free_cb;
+            timer_pool_free(_timer, tmp_elem);
+        }
+    }
+    STATS_ADD(_timer, fired_cnt, cnt);
+#ifndef MESA_TIMER_NO_STATS
+    if(cnt == max_cnt && timer_due_left(timer, current_time))
+    {
+        STATS_ADD(_timer, deferred_cnt, 1);
+    }
+#endif
+    return cnt;
+}
+
+
+
+long MESA_timer_check_inflight(MESA_timer_t *timer, long current_time, MESA_timer_inflight_t *inflight, long max_cnt)
+{
+    assert(timer != NULL && current_time >= 0 && max_cnt >= 0);
+
+    long cnt = 0, fired = 0;
+    MESA_timer_inner_t *_timer = (MESA_timer_inner_t *)timer;
+    timer_elem_t *tmp_elem;
+
+    STATS_ADD(_timer, check_cnt, 1);
+    TRACE(_timer, MESA_TIMER_TRACE_CHECK, 0, current_time, max_cnt, 0, MESA_TIMER_TRACE_CHECK_INFLIGHT);
+    timer_drain_done(_timer, current_time);
+    while(fired < max_cnt)
+    {
+        if(TAILQ_EMPTY(&(_timer->expired)))
+        {
+            long moved = timer_gather_expired(_timer, current_time, max_cnt - fired);
+            if(moved < 0)
+                return -1;
+            if(moved == 0)
+                break;
+        }
+
+        while(fired < max_cnt && (tmp_elem = TAILQ_FIRST(&(_timer->expired))) != NULL)
+        {
+            TAILQ_REMOVE(&(_timer->expired), tmp_elem, ENTRYS);
+            _timer->elem_cnt --;
+            fired ++;
+
+            /* a node is user's memory, which its callback may free */
+            if(tmp_elem->flags & ELEM_FLAG_NODE)
+            {
+                tmp_elem->status = NOT_IN_TIMER;
+                timer_invoke(_timer, tmp_elem, current_time);
+                continue;
+            }
+
+            /* neither del nor reset takes it until it is done and drained */
+            tmp_elem->status = IN_FLIGHT;
+            inflight[cnt].event = tmp_elem->event;
+            inflight[cnt].timeout_cb = tmp_elem->timeout_cb;
+            /* a periodic ENTRYS keeps its event, it is filed again when drained */
+            inflight[cnt].free_cb = (tmp_elem->flags & ELEM_FLAG_PERIODIC) ? NULL : tmp_elem->free_cb;
+            inflight[cnt].index = (MESA_timer_index_t *)tmp_elem;
+            STATS_HIST(_timer, lateness_hist, current_time - tmp_elem->expire);
+            STATS_ADD(_timer, fired_cnt, 1);
+            cnt ++;
+        }
+    }
+#ifndef MESA_TIMER_NO_STATS
+    if(fired == max_cnt && timer_due_left(timer, current_time))
+    {
+        STATS_ADD(_timer, deferred_cnt, 1);
+    }
+#endif
+    return cnt;
+}
+
+
+
+void MESA_timer_inflight_done(MESA_timer_t *timer, MESA_timer_index_t *index)
+{
+    assert(timer != NULL && index != NULL);
+
+    MESA_timer_inner_t *_timer = (MESA_timer_inner_t *)timer;
+    timer_elem_t *elem = (timer_elem_t *)index;
+    timer_elem_t *head = __atomic_load_n(&(_timer->done_stack), __ATOMIC_RELAXED);
+
+    /* the only consumer takes the whole stack, so there is no ABA */
+    do
+    {
+        TAILQ_NEXT(elem, ENTRYS) = head;
+    }while(!__atomic_compare_exchange_n(&(_timer->done_stack), &head, elem, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+
+
+/* Reset elem to current_time + timeout, slack already applied */
+static int timer_reset_elem(MESA_timer_inner_t *_timer, timer_elem_t *elem, long current_time, long timeout)
+{
+    /* its callbacks are running on another thread */
+    if(elem->status == IN_FLIGHT)
+    {
+        return -1;
+    }
+
+    STATS_ADD(_timer, reset_cnt, 1);
+    switch(_timer->type)
+    {
+        case TM_TYPE_QUEUE:
+        {
+            /* remove from timer queue */
+            if(elem->status == IN_TIMER)
+            {
+                if(elem->cursor == EXPIRED_CURSOR)
+                {
+                    TAILQ_REMOVE(&(_timer->expired), elem, ENTRYS);
+                }
+                else
+                {
+                    TAILQ_REMOVE(&(_timer->timer_queue.queue), elem, ENTRYS);
+                }
+                elem->status = NOT_IN_TIMER;
+                _timer->elem_cnt --;
+            }
+
+            /* update timer queue's last_expire_time */
+            if(!TAILQ_EMPTY(&(_timer->timer_queue.queue)))
+            {
+                timer_elem_t *tail = TAILQ_LAST(&(_timer->timer_queue.queue), TQ);
+                _timer->timer_queue.last_expire_time = tail->expire;
+            }
+            else
+            {
+                _timer->timer_queue.last_expire_time = -1;
+            }
+
+            long expire = current_time + timeout;
+            if(expire < _timer->timer_queue.last_expire_time)
+            {
+                return -1;
+            }
+            _timer->timer_queue.last_expire_time = expire;
+            elem->expire = expire;
+            /* insert a timer ENTRYS to tail of timer queue */
+            if(elem->status == NOT_IN_TIMER)
+            {
+                elem->cursor = 0;
+                TAILQ_INSERT_TAIL(&(_timer->timer_queue.queue), elem, ENTRYS);
+                elem->status = IN_TIMER;
+                _timer->elem_cnt ++;
+            }
+            
+            return 0;
+        }
+        case TM_TYPE_WHEEL:
+        {
+            timer_wheel_t *wheel = &(_timer->timer_wheel);
+            wheel_tune_sample(_timer, timeout);
+
+            /* delay in place, the ENTRYS is filed again when its spoke comes */
+            if(_timer->lazy_reset && elem->status == IN_TIMER && elem->cursor != EXPIRED_CURSOR
+               && current_time + timeout >= elem->expire)
+            {
+                elem->expire = current_time + timeout;
+                return 0;
+            }
+
+            if(elem->status == IN_TIMER)
+            {
+                if(elem->cursor == EXPIRED_CURSOR)
+                {
+                    TAILQ_REMOVE(&(_timer->expired), elem, ENTRYS);
+                }
+                else
+                {
+                    wheel_remove(wheel, elem);
+                }
+                elem->status = NOT_IN_TIMER;
+                _timer->elem_cnt --;
+            }
+
+            /* the first timer ENTRYS start the timer, and current_time's relative time is 0 */
+            if(wheel->last_check_relative_tick == -1)
+            {
+                wheel->create_time = current_time;
+                wheel->last_check_relative_tick = 0;
+                wheel->spoke_index = 0;
+            }
+
+            /* if expire time of user's reset operation is earlier than Timer's current time, 
+             * we need set it with current time and make it timeout when next checking */
+            long timer_curr_time = wheel->create_time + wheel->last_check_relative_tick;
+            long user_reset_expire_time = current_time + timeout;
+            if(timer_curr_time >= user_reset_expire_time)
+            {
+                timeout = 1;
+                current_time = timer_curr_time;
+            }
+
+            elem->expire = current_time + timeout;
+
+            /* insert a timer ENTRYS to tail of its spoke */
+            if(elem->status == NOT_IN_TIMER)
+            {
+                wheel_insert(wheel, elem);
+                elem->status = IN_TIMER;
+                _timer->elem_cnt ++;
+            }
+            return 0;
+        }
+        case TM_TYPE_HWHEEL:
+        {
+            timer_hwheel_t *hw = &(_timer->timer_hwheel);
+
+            /* delay in place, the ENTRYS is filed again when its slot comes */
+            if(_timer->lazy_reset && elem->status == IN_TIMER && elem->cursor != EXPIRED_CURSOR
+               && current_time + timeout >= elem->expire)
+            {
+                elem->expire = current_time + timeout;
+                return 0;
+            }
+
+            if(elem->status == IN_TIMER)
+            {
+                if(elem->cursor == EXPIRED_CURSOR)
+                {
+                    TAILQ_REMOVE(&(_timer->expired), elem, ENTRYS);
+                }
+                else
+                {
+                    hwheel_remove(hw, elem);
+                }
+                elem->status = NOT_IN_TIMER;
+                _timer->elem_cnt --;
+            }
+
+            /* the first timer ENTRYS start the timer at current_time */
+            if(hw->current == -1)
+            {
+                hw->current = current_time;
+            }
+
+            /* an expire at a tick already checked is filed at the current
+             * tick and times out when a check reaches it */
+            elem->expire = current_time + timeout;
+            hwheel_insert(_timer, elem);
+
+            elem->status = IN_TIMER;
+            _timer->elem_cnt ++;
+            return 0;
+        }
+        case TM_TYPE_HEAP:
+        {
+            elem->expire = current_time + timeout;
+            if(elem->status == IN_TIMER && elem->cursor != EXPIRED_CURSOR)
             {
-                elem->free_cb(elem->event);
+                heap_update(&(_timer->timer_heap), elem);
+                return 0;
             }
-            free(elem);
-            break;
+
+            if(elem->status == IN_TIMER)
+            {
+                TAILQ_REMOVE(&(_timer->expired), elem, ENTRYS);
+            }
+            else
+            {
+                elem->status = IN_TIMER;
+                _timer->elem_cnt ++;
+            }
+            heap_insert(_timer, elem);
+            return 0;
+        }
+        case TM_TYPE_MQUEUE:
+        {
+            timer_mqueue_t *mq = &(_timer->timer_mqueue);
+            int cls = mqueue_class(mq, timeout, 1);
+            if(cls == -1)
+            {
+                return -1;
+            }
+
+            if(elem->status == IN_TIMER)
+            {
+                if(elem->cursor == EXPIRED_CURSOR)
+                {
+                    TAILQ_REMOVE(&(_timer->expired), elem, ENTRYS);
+                }
+                else
+                {
+                    mqueue_remove(mq, elem);
+                }
+            }
+            else
+            {
+                elem->status = IN_TIMER;
+                _timer->elem_cnt ++;
+            }
+            elem->expire = current_time + timeout;
+            mqueue_insert(mq, elem, cls);
+            return 0;
+        }
+        case TM_TYPE_SWHEEL:
+        {
+            timer_wheel_t *wheel = &(_timer->timer_swheel.wheel);
+
+            /* delay in place, the ENTRYS is filed again when its spoke comes */
+            if(_timer->lazy_reset && elem->status == IN_TIMER && elem->cursor != EXPIRED_CURSOR
+               && current_time + timeout >= elem->expire)
+            {
+                elem->expire = current_time + timeout;
+                return 0;
+            }
+
+            if(elem->status == IN_TIMER)
+            {
+                if(elem->cursor == EXPIRED_CURSOR)
+                {
+                    TAILQ_REMOVE(&(_timer->expired), elem, ENTRYS);
+                }
+                else
+                {
+                    swheel_remove(&(_timer->timer_swheel), elem);
+                }
+                elem->status = NOT_IN_TIMER;
+                _timer->elem_cnt --;
+            }
+
+            /* the first timer ENTRYS start the timer, and current_time's relative time is 0 */
+            if(wheel->last_check_relative_tick == -1)
+            {
+                wheel->create_time = current_time;
+                wheel->last_check_relative_tick = 0;
+                wheel->spoke_index = 0;
+            }
+
+            /* an expire earlier than timer's current time times out when next checking */
+            long timer_curr_time = wheel->create_time + wheel->last_check_relative_tick;
+            if(timer_curr_time >= current_time + timeout)
+            {
+                timeout = 1;
+                current_time = timer_curr_time;
+            }
+            elem->expire = current_time + timeout;
+
+            swheel_insert(_timer, elem);
+            elem->status = IN_TIMER;
+            _timer->elem_cnt ++;
+            return 0;
+        }
+        default:
+        {
+            return -1;
+        }
+    }
+}
+
+
+
+int MESA_timer_reset(MESA_timer_t *timer, MESA_timer_index_t *index, long current_time, long timeout)
+{
+    assert(timer != NULL && index != NULL);
+
+    MESA_timer_inner_t *_timer = (MESA_timer_inner_t *)timer;
+    timer_elem_t *elem = (timer_elem_t *)index;
+
+    if(!(elem->flags & ELEM_FLAG_NODE))
+    {
+        TRACE(_timer, MESA_TIMER_TRACE_RESET, elem->id, current_time, timeout, -1, 0);
+    }
+    return timer_reset_elem(_timer, elem, current_time, timer_slack(_timer, current_time, timeout));
+}
+
+
+
+int MESA_timer_reset_slack(MESA_timer_t *timer, MESA_timer_index_t *index, long current_time, long timeout, long slack)
+{
+    assert(timer != NULL && index != NULL && slack >= 0);
+
+    MESA_timer_inner_t *_timer = (MESA_timer_inner_t *)timer;
+    timer_elem_t *elem = (timer_elem_t *)index;
+
+    if(!(elem->flags & ELEM_FLAG_NODE))
+    {
+        TRACE(_timer, MESA_TIMER_TRACE_RESET, elem->id, current_time, timeout, slack, 0);
+    }
+    return timer_reset_elem(_timer, elem, current_time, timer_apply_slack(_timer, current_time, timeout, slack));
+}
+
+
+
+long MESA_timer_now(MESA_timer_t *timer)
+{
+    assert(timer != NULL);
+    return ((MESA_timer_inner_t *)timer)->clock.now;
+}
+
+
+
+long MESA_timer_check_now(MESA_timer_t *timer, long max_cb_times)
+{
+    assert(timer != NULL);
+
+    MESA_timer_inner_t *_timer = (MESA_timer_inner_t *)timer;
+    if(_timer->clock.mode == MESA_TIMER_CLOCK_NONE)
+    {
+        return -1;
+    }
+    return MESA_timer_check(timer, timer_clock_refresh(&(_timer->clock)), max_cb_times);
+}
+
+
+
+int MESA_timer_add_now(MESA_timer_t *timer,
+                       long timeout,
+                       timeout_cb_t timeout_cb,
+                       void *event,
+                       event_free_cb_t free_cb,
+                       MESA_timer_index_t **index)
+{
+    assert(timer != NULL);
+
+    MESA_timer_inner_t *_timer = (MESA_timer_inner_t *)timer;
+    if(_timer->clock.mode == MESA_TIMER_CLOCK_NONE)
+    {
+        *index = NULL;
+        return -1;
+    }
+    return MESA_timer_add(timer, _timer->clock.now, timeout, timeout_cb, event, free_cb, index);
+}
+
+
+
+int MESA_timer_add_h_now(MESA_timer_t *timer,
+                         long timeout,
+                         timeout_cb_t timeout_cb,
+                         void *event,
+                         event_free_cb_t free_cb,
+                         MESA_timer_handle_t *handle)
+{
+    assert(timer != NULL);
+
+    MESA_timer_inner_t *_timer = (MESA_timer_inner_t *)timer;
+    if(_timer->clock.mode == MESA_TIMER_CLOCK_NONE)
+    {
+        *handle = MESA_TIMER_HANDLE_INVALID;
+        return -1;
+    }
+    return MESA_timer_add_h(timer, _timer->clock.now, timeout, timeout_cb, event, free_cb, handle);
+}
+
+
+
+int MESA_timer_reset_now(MESA_timer_t *timer, MESA_timer_index_t *index, long timeout)
+{
+    assert(timer != NULL);
+
+    MESA_timer_inner_t *_timer = (MESA_timer_inner_t *)timer;
+    if(_timer->clock.mode == MESA_TIMER_CLOCK_NONE)
+    {
+        return -1;
+    }
+    return MESA_timer_reset(timer, index, _timer->clock.now, timeout);
+}
+
+
+
+int MESA_timer_reset_h_now(MESA_timer_t *timer, MESA_timer_handle_t handle, long timeout)
+{
+    assert(timer != NULL);
+
+    MESA_timer_inner_t *_timer = (MESA_timer_inner_t *)timer;
+    if(_timer->clock.mode == MESA_TIMER_CLOCK_NONE)
+    {
+        return -1;
+    }
+    return MESA_timer_reset_h(timer, handle, _timer->clock.now, timeout);
+}
+
+
+long MESA_timer_count(MESA_timer_t *timer)
+{
+    assert(timer != NULL);
+    return ((MESA_timer_inner_t *)timer)->elem_cnt;
+}
+
+
+
+long MESA_timer_memsize(MESA_timer_t *timer)
+{
+    assert(timer != NULL);
+    return ((MESA_timer_inner_t *)timer)->mem_ocupy;
+}
+
+
+
+long MESA_timer_early_expired(MESA_timer_t *timer)
+{
+    assert(timer != NULL);
+    return ((MESA_timer_inner_t *)timer)->early_cnt;
+}
+
+
+
+int MESA_timer_resize(MESA_timer_t *timer, long new_size)
+{
+    assert(timer != NULL);
+
+    MESA_timer_inner_t *_timer = (MESA_timer_inner_t *)timer;
+
+    if(_timer->type != TM_TYPE_WHEEL || new_size <= 0 || new_size > MAX_WHEEL_SIZE)
+    {
+        return -1;
+    }
+    wheel_resize(_timer, new_size);
+    return 0;
+}
+
+
+
+long MESA_timer_next_expire(MESA_timer_t *timer)
+{
+    assert(timer != NULL);
+
+    MESA_timer_inner_t *_timer = (MESA_timer_inner_t *)timer;
+
+    /* expired ENTRYS deferred by max_cb_times are due at once */
+    if(!TAILQ_EMPTY(&(_timer->expired)))
+    {
+        return TAILQ_FIRST(&(_timer->expired))->expire;
+    }
+
+    switch(_timer->type)
+    {
+        case TM_TYPE_QUEUE:
+        {
+            timer_elem_t *head = TAILQ_FIRST(&(_timer->timer_queue.queue));
+            return head != NULL ? head->expire : -1;
+        }
+        case TM_TYPE_WHEEL:
+        case TM_TYPE_SWHEEL:
+        {
+            timer_wheel_t *wheel = _timer->type == TM_TYPE_WHEEL ? &(_timer->timer_wheel) : &(_timer->timer_swheel.wheel);
+            if(wheel->create_time == -1)
+                return -1;
+
+            /* the nearest non-empty spoke, ENTRYS of a spoke time out one tick
+             * after the spoke's relative tick */
+            long distance = wheel_next_distance(wheel), next = -1;
+            if(distance != -1)
+                next = wheel->create_time + wheel->last_check_relative_tick + distance + 1;
+            if(wheel->old_spokes != NULL)
+            {
+                long old_next = wheel_old_next(wheel);
+                if(old_next != -1 && (next == -1 || old_next < next))
+                    next = old_next;
+            }
+            return next;
+        }
+        case TM_TYPE_HWHEEL:
+        {
+            timer_hwheel_t *hw = &(_timer->timer_hwheel);
+            if(hw->current == -1)
+                return -1;
+            return hwheel_next_tick(hw);
+        }
+        case TM_TYPE_HEAP:
+        {
+            timer_heap_t *heap = &(_timer->timer_heap);
+            return heap->size > 0 ? heap->entries[0].expire : -1;
+        }
+        case TM_TYPE_MQUEUE:
+        {
+            timer_mqueue_t *mq = &(_timer->timer_mqueue);
+            return mq->min_class != -1 ? mq->head_expire[mq->min_class] : -1;
+        }
+        default:
+            return -1;
+    }
+}
+
+
+
+#ifndef MESA_TIMER_NO_STATS
+/* Count elements of each list into occupancy histogram */
+static void stats_occupancy(long *hist, struct TQ *queues, long n)
+{
+    timer_elem_t *tmp_elem;
+    long i, cnt;
+
+    for(i = 0; i < n; i++)
+    {
+        cnt = 0;
+        TAILQ_FOREACH(tmp_elem, &(queues[i]), ENTRYS)
+        {
+            cnt ++;
         }
+        hist[stats_bucket(cnt)] ++;
+    }
+}
+#endif
+
+
+
+int MESA_timer_stats(MESA_timer_t *timer, MESA_timer_stats_t *stats)
+{
+    assert(timer != NULL && stats != NULL);
+
+#ifdef MESA_TIMER_NO_STATS
+    memset(stats, 0, sizeof(MESA_timer_stats_t));
+    return -1;
+#else
+    MESA_timer_inner_t *_timer = (MESA_timer_inner_t *)timer;
+    long i;
+
+    *stats = _timer->stats;
+    memset(stats->occupancy_hist, 0, sizeof(stats->occupancy_hist));
+    switch(_timer->type)
+    {
+        case TM_TYPE_WHEEL:
+            stats_occupancy(stats->occupancy_hist, _timer->timer_wheel.spokes, _timer->timer_wheel.wheel_size);
+            break;
+        case TM_TYPE_HWHEEL:
+            stats_occupancy(stats->occupancy_hist, _timer->timer_hwheel.slots, HWHEEL_SLOTS);
+            break;
+        case TM_TYPE_MQUEUE:
+            stats_occupancy(stats->occupancy_hist, _timer->timer_mqueue.queues, _timer->timer_mqueue.class_cnt);
+            break;
+        case TM_TYPE_SWHEEL:
+            for(i = 0; i < _timer->timer_swheel.wheel.wheel_size; i++)
+            {
+                stats->occupancy_hist[stats_bucket(_timer->timer_swheel.spokes[i].cnt)] ++;
+            }
+            break;
         default:
             break;
     }
-    return ret_timeout;
+    return 0;
+#endif
+}
+
+
+
+void MESA_timer_stats_reset(MESA_timer_t *timer)
+{
+    assert(timer != NULL);
+
+#ifndef MESA_TIMER_NO_STATS
+    memset(&(((MESA_timer_inner_t *)timer)->stats), 0, sizeof(MESA_timer_stats_t));
+#endif
+}
+
+
+
+void MESA_timer_set_trace(MESA_timer_t *timer, MESA_timer_trace_t *trace)
+{
+    assert(timer != NULL);
+
+    MESA_timer_inner_t *_timer = (MESA_timer_inner_t *)timer;
+    long wheel_size = 0;
+
+    _timer->trace = trace;
+    if(trace == NULL)
+    {
+        return;
+    }
+    if(_timer->type == TM_TYPE_WHEEL)
+    {
+        wheel_size = _timer->timer_wheel.wheel_size;
+    }
+    else if(_timer->type == TM_TYPE_SWHEEL)
+    {
+        wheel_size = _timer->timer_swheel.wheel.wheel_size;
+    }
+    else if(_timer->type == TM_TYPE_MQUEUE)
+    {
+        wheel_size = _timer->timer_mqueue.class_max;
+    }
+    timer_trace(_timer, MESA_TIMER_TRACE_START, _timer->slack_pct, -1, _timer->type, wheel_size,
+                _timer->lazy_reset ? MESA_TIMER_TRACE_START_LAZY_RESET : 0);
 }
 
 
 
-long MESA_timer_check(MESA_timer_t *timer, long current_time, long max_cb_times)
+/**
+ * Snapshot file's header, followed by count records. Every field is 8-byte
+ * aligned so that the file is read in place when mapped.
+ **/
+typedef struct _snapshot_header_t{
+    char magic[8];                  /* SNAPSHOT_MAGIC */
+    uint32_t version;               /* SNAPSHOT_VERSION */
+    int32_t type;                   /* type of the saved timer */
+    int64_t wheel_size;             /* wheel_size of the time wheels, 0 for others */
+    int64_t snap_time;              /* current_time of the snapshot */
+    int64_t base_time;              /* time the time wheels are checked to, -1 if not started */
+    int64_t spoke_index;            /* spoke of base_time */
+    int64_t count;                  /* records */
+}snapshot_header_t;
+
+
+/**
+ * Snapshot record of an event, followed by len bytes of serialized event
+ * padded to 8 bytes
+ **/
+typedef struct _snapshot_record_t{
+    int64_t remaining;              /* expire - snap_time */
+    int64_t rotation;               /* rotations left in the time wheels, timeout of the class
+                                     * in the multi-class queue */
+    int64_t cursor;                 /* spoke in the time wheels, EXPIRED_CURSOR if deferred */
+    int64_t interval;               /* interval of a periodic event, 0 for others */
+    int64_t flags;                  /* MESA_TIMER_PERIODIC_* of a periodic event */
+    int64_t len;
+}snapshot_record_t;
+
+
+typedef struct _snapshot_writer_t{
+    MESA_timer_inner_t *timer;
+    FILE *fp;
+    event_serialize_cb_t serialize;
+    void *arg;
+    char *buf;                      /* record being written */
+    long size;                      /* room for the serialized event in buf */
+    long snap_time;
+    long count;                     /* records written */
+    int error;
+}snapshot_writer_t;
+
+
+
+static void snapshot_write(snapshot_writer_t *w, timer_elem_t *elem, long rotation, long cursor)
 {
-    assert(timer != NULL && current_time >= 0 && max_cb_times >= 0);
+    snapshot_record_t *rec;
+    long len;
+
+    if(w->error || (elem->flags & ELEM_FLAG_NODE))
+    {
+        return;
+    }
+    /* buf is the record, the serialized event and its padding */
+    len = w->serialize(elem->event, elem->timeout_cb, w->buf + sizeof(snapshot_record_t), w->size, w->arg);
+    if(len > w->size)
+    {
+        w->size = len;
+        w->buf = (char *)realloc(w->buf, sizeof(snapshot_record_t) + SNAPSHOT_ALIGN(w->size));
+        len = w->serialize(elem->event, elem->timeout_cb, w->buf + sizeof(snapshot_record_t), w->size, w->arg);
+    }
+    if(len < 0)
+    {
+        return;
+    }
+    if(len > w->size)
+    {
+        w->error = 1;
+        return;
+    }
+
+    rec = (snapshot_record_t *)w->buf;
+    rec->remaining = elem->expire - w->snap_time;
+    rec->rotation = rotation;
+    rec->cursor = cursor;
+    rec->interval = 0;
+    rec->flags = 0;
+    if(elem->flags & ELEM_FLAG_PERIODIC)
+    {
+        rec->interval = *timer_pool_interval(w->timer, elem);
+        if(elem->flags & ELEM_FLAG_DRIFT_FREE)
+            rec->flags |= MESA_TIMER_PERIODIC_DRIFT_FREE;
+        if(elem->flags & ELEM_FLAG_SKIP_MISSED)
+            rec->flags |= MESA_TIMER_PERIODIC_SKIP_MISSED;
+    }
+    rec->len = len;
+    memset(w->buf + sizeof(snapshot_record_t) + len, 0, SNAPSHOT_ALIGN(len) - len);
+    if(fwrite(w->buf, sizeof(snapshot_record_t) + SNAPSHOT_ALIGN(len), 1, w->fp) != 1)
+    {
+        w->error = 1;
+        return;
+    }
+    w->count ++;
+}
+
+
+
+long MESA_timer_snapshot(MESA_timer_t *timer, const char *path, long current_time,
+                         event_serialize_cb_t serialize, void *arg)
+{
+    assert(timer != NULL && path != NULL && serialize != NULL);
 
-    long cb_cnt = 0;
     MESA_timer_inner_t *_timer = (MESA_timer_inner_t *)timer;
+    snapshot_header_t header;
+    snapshot_writer_t w;
+    timer_elem_t *tmp_elem;
+    char *tmp_path;
+    long i;
+    int j;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.type = _timer->type;
+    header.snap_time = current_time;
+    header.base_time = -1;
+
+    tmp_path = (char *)malloc(strlen(path) + sizeof(".tmp"));
+    sprintf(tmp_path, "%s.tmp", path);
+    memset(&w, 0, sizeof(w));
+    w.fp = fopen(tmp_path, "wb");
+    if(w.fp == NULL)
+    {
+        free(tmp_path);
+        return -1;
+    }
+    w.timer = _timer;
+    w.serialize = serialize;
+    w.arg = arg;
+    w.size = SNAPSHOT_BUF_INIT;
+    w.buf = (char *)malloc(sizeof(snapshot_record_t) + SNAPSHOT_ALIGN(w.size));
+    w.snap_time = current_time;
+
+    /* the header is written again with count at last */
+    if(fwrite(&header, sizeof(header), 1, w.fp) != 1)
+    {
+        w.error = 1;
+    }
 
+    TAILQ_FOREACH(tmp_elem, &(_timer->expired), ENTRYS)
+    {
+        snapshot_write(&w, tmp_elem, 0, EXPIRED_CURSOR);
+    }
     switch(_timer->type)
     {
         case TM_TYPE_QUEUE:
         {
-            timer_elem_t *tmp_elem = TAILQ_FIRST(&(_timer->timer_queue.queue));
-            timer_elem_t *tmp;
-            while(tmp_elem != NULL)
+            TAILQ_FOREACH(tmp_elem, &(_timer->timer_queue.queue), ENTRYS)
+            {
+                snapshot_write(&w, tmp_elem, 0, 0);
+            }
+            break;
+        }
+        case TM_TYPE_WHEEL:
+        {
+            timer_wheel_t *wheel = &(_timer->timer_wheel);
+            wheel_migrate_all(_timer);
+            header.wheel_size = wheel->wheel_size;
+            if(wheel->create_time == -1)
+                break;
+            header.base_time = wheel->create_time + wheel->last_check_relative_tick;
+            header.spoke_index = wheel->spoke_index;
+            for(i = 0; i < wheel->wheel_size; i++)
             {
-                if(cb_cnt >= max_cb_times)
+                long spoke = (wheel->spoke_index + i) % wheel->wheel_size;
+                TAILQ_FOREACH(tmp_elem, &(wheel->spokes[spoke]), ENTRYS)
                 {
-                    break;
+                    snapshot_write(&w, tmp_elem, tmp_elem->rotation_cnt, spoke);
                 }
-                /* All ENTRYSs after tmp_elem haven't time out */
-                if(current_time < tmp_elem->expire)
+            }
+            break;
+        }
+        case TM_TYPE_HWHEEL:
+        {
+            for(i = 0; i < HWHEEL_SLOTS; i++)
+            {
+                TAILQ_FOREACH(tmp_elem, &(_timer->timer_hwheel.slots[i]), ENTRYS)
                 {
-                    break;
+                    snapshot_write(&w, tmp_elem, 0, 0);
                 }
-
-                tmp = TAILQ_NEXT(tmp_elem, ENTRYS);
-                TAILQ_REMOVE(&(_timer->timer_queue.queue), tmp_elem, ENTRYS);
-                tmp_elem->status= NOT_IN_TIMER;
-            
-                _timer->elem_cnt --;
-                _timer->mem_ocupy -= sizeof(timer_elem_t);
-
-                /* elem has timed out */
-                tmp_elem->timeout_cb(tmp_elem->event);
-                cb_cnt ++;
-
-                if(tmp_elem->status == NOT_IN_TIMER)
+            }
+            break;
+        }
+        case TM_TYPE_HEAP:
+        {
+            for(i = 0; i < _timer->timer_heap.size; i++)
+            {
+                snapshot_write(&w, _timer->timer_heap.entries[i].elem, 0, 0);
+            }
+            break;
+        }
+        case TM_TYPE_MQUEUE:
+        {
+            for(j = 0; j < _timer->timer_mqueue.class_cnt; j++)
+            {
+                TAILQ_FOREACH(tmp_elem, &(_timer->timer_mqueue.queues[j]), ENTRYS)
                 {
-                    if(tmp_elem->free_cb != NULL)
-                    {
-                        tmp_elem->free_cb(tmp_elem->event);
-                    }
-                    free(tmp_elem);
+                    snapshot_write(&w, tmp_elem, _timer->timer_mqueue.timeouts[j], 0);
                 }
-                tmp_elem = tmp;
             }
-            return cb_cnt;
+            break;
         }
-        case TM_TYPE_WHEEL:
+        case TM_TYPE_SWHEEL:
         {
-            timer_wheel_t *wheel = &(_timer->timer_wheel);
-            struct TQ *spoke;
-
-            if(wheel->create_time == -1)
-                return 0;
-
-            int i, cb_max_flag = 0;
-            long tickcnt = current_time - wheel->create_time - wheel->last_check_relative_tick;
-            wheel->last_check_relative_tick += tickcnt;
-
-            for(i = 0; i < tickcnt; i++)
+            timer_swheel_t *sw = &(_timer->timer_swheel);
+            header.wheel_size = sw->wheel.wheel_size;
+            if(sw->wheel.create_time == -1)
+                break;
+            header.base_time = sw->wheel.create_time + sw->wheel.last_check_relative_tick;
+            header.spoke_index = sw->wheel.spoke_index;
+            for(i = 0; i < sw->wheel.wheel_size; i++)
             {
-                spoke = &(wheel->spokes[wheel->spoke_index]);
-                timer_elem_t *tmp_elem = TAILQ_FIRST(spoke);
-                timer_elem_t *tmp;
-                while(tmp_elem != NULL)
+                long spoke = (sw->wheel.spoke_index + i) % sw->wheel.wheel_size;
+                for(j = 0; j < sw->spokes[spoke].cnt; j++)
                 {
-                    if(tmp_elem->rotation_cnt != 0)
-                    {
-                        tmp_elem->rotation_cnt --;
-                        tmp_elem = TAILQ_NEXT(tmp_elem, ENTRYS);
-                    }
-                    else
-                    {
-                        if(cb_cnt >= max_cb_times)
-                        {
-                            cb_max_flag = 1;
-                            break;
-                        }
-                        tmp = TAILQ_NEXT(tmp_elem, ENTRYS);
-                        TAILQ_REMOVE(spoke, tmp_elem, ENTRYS);
-                        tmp_elem->status = NOT_IN_TIMER;
-
-                        _timer->elem_cnt --;
-                        _timer->mem_ocupy -= sizeof(timer_elem_t);
-                        
-                        tmp_elem->timeout_cb(tmp_elem->event);
-                        cb_cnt ++;
-
-                        if(tmp_elem->status == NOT_IN_TIMER)
-                        {
-                            if(tmp_elem->free_cb != NULL)
-                            {
-                                tmp_elem->free_cb(tmp_elem->event); 
-                            }
-                            free(tmp_elem);
-                        }
-                        tmp_elem = tmp;
-                    }
+                    snapshot_write(&w, sw->spokes[spoke].elems[j], sw->spokes[spoke].rotations[j], spoke);
                 }
-                if(cb_max_flag == 1)
-                    break;
-                wheel->spoke_index = (wheel->spoke_index + 1) % wheel->wheel_size;
             }
-            return cb_cnt;
+            break;
         }
         default:
-        {
-            return -1;
-        }
+            w.error = 1;
+            break;
+    }
+
+    header.count = w.count;
+    if(fseek(w.fp, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, w.fp) != 1)
+    {
+        w.error = 1;
+    }
+    if(fclose(w.fp) != 0)
+    {
+        w.error = 1;
+    }
+    if(!w.error && rename(tmp_path, path) != 0)
+    {
+        w.error = 1;
+    }
+    if(w.error)
+    {
+        unlink(tmp_path);
     }
+    free(tmp_path);
+    free(w.buf);
+    return w.error ? -1 : w.count;
 }
 
 
 
-int MESA_timer_reset(MESA_timer_t *timer, MESA_timer_index_t *index, long current_time, long timeout)
+long MESA_timer_restore(MESA_timer_t *timer, const char *path, long current_time,
+                        event_deserialize_cb_t deserialize, void *arg)
 {
-    assert(timer != NULL && index != NULL);
+    assert(timer != NULL && path != NULL && deserialize != NULL && current_time >= 0);
 
     MESA_timer_inner_t *_timer = (MESA_timer_inner_t *)timer;
-    timer_elem_t *elem = (timer_elem_t *)index;
+    const snapshot_header_t *header;
+    const snapshot_record_t *rec;
+    MESA_timer_restored_t restored;
+    timer_wheel_t *wheel = NULL;
+    timer_elem_t *elem;
+    struct stat st;
+    char *map;
+    long pos, i, restored_cnt = 0;
+    int fd, in_place = 0;
 
-    switch(_timer->type)
+    fd = open(path, O_RDONLY);
+    if(fd < 0)
     {
-        case TM_TYPE_QUEUE:
+        return -1;
+    }
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(snapshot_header_t))
+    {
+        close(fd);
+        return -1;
+    }
+    map = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        return -1;
+    }
+    header = (const snapshot_header_t *)map;
+    if(memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 || header->version != SNAPSHOT_VERSION)
+    {
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    /* an empty wheel of the same shape takes the saved position, and
+     * ENTRYSs go back to their spokes */
+    if(_timer->type == TM_TYPE_WHEEL)
+    {
+        wheel = &(_timer->timer_wheel);
+        wheel_migrate_all(_timer);
+    }
+    else if(_timer->type == TM_TYPE_SWHEEL)
+    {
+        wheel = &(_timer->timer_swheel.wheel);
+    }
+    if(wheel != NULL && header->type == _timer->type && header->wheel_size == wheel->wheel_size
+       && header->base_time != -1 && _timer->elem_cnt == 0)
+    {
+        wheel->create_time = header->base_time + current_time - header->snap_time;
+        wheel->last_check_relative_tick = 0;
+        wheel->spoke_index = header->spoke_index;
+        in_place = 1;
+    }
+
+    pos = sizeof(snapshot_header_t);
+    for(i = 0; i < header->count; i++)
+    {
+        rec = (const snapshot_record_t *)(map + pos);
+        if(pos + (long)sizeof(snapshot_record_t) > st.st_size || rec->len < 0
+           || rec->len > st.st_size - pos - (long)sizeof(snapshot_record_t))
         {
-            /* remove from timer queue */
-            if(elem->status == IN_TIMER)
-            {
-                TAILQ_REMOVE(&(_timer->timer_queue.queue), elem, ENTRYS);
-                elem->status = NOT_IN_TIMER;
-                _timer->elem_cnt --;
-                _timer->mem_ocupy -= sizeof(timer_elem_t);
-            }
+            break;
+        }
+        pos += sizeof(snapshot_record_t) + SNAPSHOT_ALIGN(rec->len);
 
-            /* update timer queue's last_expire_time */
-            if(!TAILQ_EMPTY(&(_timer->timer_queue.queue)))
-            {
-                timer_elem_t *tail = TAILQ_LAST(&(_timer->timer_queue.queue), TQ);
-                _timer->timer_queue.last_expire_time = tail->expire;
-            }
-            else
-            {
-                _timer->timer_queue.last_expire_time = -1;
-            }
+        memset(&restored, 0, sizeof(restored));
+        if(deserialize(rec + 1, rec->len, &restored, arg) != 0)
+        {
+            continue;
+        }
+        elem = timer_pool_alloc(_timer);
+        elem->timeout_cb = restored.timeout_cb;
+        elem->event = restored.event;
+        elem->free_cb = restored.free_cb;
 
-            long expire = current_time + timeout;
-            if(expire < _timer->timer_queue.last_expire_time)
-            {
-                return -1;
-            }
-            _timer->timer_queue.last_expire_time = expire;
-            elem->expire = expire;
-            /* insert a timer ENTRYS to tail of timer queue */
-            if(elem->status == NOT_IN_TIMER)
+        /* a periodic event of a multi-class queue needs the class of its
+         * interval besides the one it is filed in now */
+        if(rec->interval > 0 && _timer->type == TM_TYPE_MQUEUE
+           && !mqueue_periodic_fits(&(_timer->timer_mqueue), rec->cursor == EXPIRED_CURSOR ? rec->interval
+                                    : header->type == TM_TYPE_MQUEUE ? rec->rotation
+                                    : (rec->remaining > 0 ? rec->remaining : 0), rec->interval))
+        {
+            if(elem->free_cb != NULL)
             {
-                TAILQ_INSERT_TAIL(&(_timer->timer_queue.queue), elem, ENTRYS);
-                elem->status = IN_TIMER;
-                _timer->elem_cnt ++;
-                _timer->mem_ocupy += sizeof(timer_elem_t);
+                elem->free_cb(elem->event);
             }
-            
-            return 0;
+            timer_pool_free(_timer, elem);
+            continue;
         }
-        case TM_TYPE_WHEEL:
+
+        if(in_place && rec->cursor >= 0 && rec->cursor < wheel->wheel_size && rec->rotation >= 0 && rec->rotation <= INT_MAX)
         {
-            timer_wheel_t *wheel = &(_timer->timer_wheel);
-            if(elem->status == IN_TIMER)
+            elem->expire = current_time + rec->remaining;
+            if(_timer->type == TM_TYPE_WHEEL)
             {
-                TAILQ_REMOVE(&(wheel->spokes[elem->cursor]), elem, ENTRYS);
-                elem->status = NOT_IN_TIMER;
-                _timer->elem_cnt --;
-                _timer->mem_ocupy -= sizeof(timer_elem_t);
+                elem->rotation_cnt = rec->rotation;
+                elem->cursor = rec->cursor;
+                elem->flags |= wheel->epoch;
+                TAILQ_INSERT_TAIL(&(wheel->spokes[elem->cursor]), elem, ENTRYS);
+                bitmap_set(wheel->bitmap, elem->cursor);
             }
-
-            /* the first timer ENTRYS start the timer, and current_time's relative time is 0 */
-            if(wheel->last_check_relative_tick == -1)
+            else
             {
-                wheel->create_time = current_time;
-                wheel->last_check_relative_tick = 0;
-                wheel->spoke_index = 0;
+                swheel_push(_timer, elem, rec->cursor, rec->rotation);
             }
-
-            /* if expire time of user's reset operation is earlier than Timer's current time, 
-             * we need set it with current time and make it timeout when next checking */
-            long timer_curr_time = wheel->create_time + wheel->last_check_relative_tick;
-            long user_reset_expire_time = current_time + timeout;
-            if(timer_curr_time >= user_reset_expire_time)
+            elem->status = IN_TIMER;
+            _timer->elem_cnt ++;
+        }
+        else if(rec->cursor == EXPIRED_CURSOR)
+        {
+            elem->expire = current_time + rec->remaining;
+            elem->cursor = EXPIRED_CURSOR;
+            TAILQ_INSERT_TAIL(&(_timer->expired), elem, ENTRYS);
+            elem->status = IN_TIMER;
+            _timer->elem_cnt ++;
+        }
+        else if(_timer->type == TM_TYPE_MQUEUE && header->type == TM_TYPE_MQUEUE)
+        {
+            /* back to the class of its timeout, with its remaining time */
+            int cls = mqueue_class(&(_timer->timer_mqueue), rec->rotation, 1);
+            if(cls == -1)
             {
-                timeout = 1;
-                current_time = timer_curr_time;
+                if(elem->free_cb != NULL)
+                {
+                    elem->free_cb(elem->event);
+                }
+                timer_pool_free(_timer, elem);
+                continue;
             }
-
-            elem->expire = current_time + timeout;
-
-            long td = timeout % wheel->wheel_size;
-            elem->rotation_cnt = timeout / wheel->wheel_size;
-            long cursor = (current_time - wheel->create_time + td) % wheel->wheel_size;
-            elem->cursor = cursor;
-
-            /* insert a timer ENTRYS to tail of timer queue */
-            if(elem->status == NOT_IN_TIMER)
+            elem->expire = current_time + rec->remaining;
+            mqueue_insert(&(_timer->timer_mqueue), elem, cls);
+            elem->status = IN_TIMER;
+            _timer->elem_cnt ++;
+        }
+        else if(timer_insert_elem(_timer, current_time, rec->remaining > 0 ? rec->remaining : 0, elem) != 0)
+        {
+            if(elem->free_cb != NULL)
             {
-                TAILQ_INSERT_TAIL(&(wheel->spokes[cursor]), elem, ENTRYS);
-                elem->status = IN_TIMER;
-                _timer->elem_cnt ++;
-                _timer->mem_ocupy += sizeof(timer_elem_t);
+                elem->free_cb(elem->event);
             }
-            return 0;
+            timer_pool_free(_timer, elem);
+            continue;
         }
-        default:
+        if(rec->interval > 0)
         {
-            return -1;
+            timer_set_periodic(_timer, elem, rec->interval, rec->flags);
         }
-    }
-}
-
-
-long MESA_timer_count(MESA_timer_t *timer)
-{
-    assert(timer != NULL);
-    return ((MESA_timer_inner_t *)timer)->elem_cnt;
-}
-
 
+        if(restored.index != NULL)
+        {
+            *(restored.index) = (MESA_timer_index_t *)elem;
+        }
+        restored_cnt ++;
+    }
 
-long MESA_timer_memsize(MESA_timer_t *timer)
-{
-    assert(timer != NULL);
-    return ((MESA_timer_inner_t *)timer)->mem_ocupy;
+    munmap(map, st.st_size);
+    STATS_ADD(_timer, add_cnt, restored_cnt);
+    return restored_cnt;
 }
-
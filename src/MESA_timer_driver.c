@@ -0,0 +1,230 @@
+/************************************************
+*				MESA timer driver API
+* A timerfd armed to MESA_timer_next_expire, so that
+* the timer is checked exactly when an event is due.
+************************************************/
+#include "MESA_timer_driver.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+
+/* armed deadline when the timerfd is disarmed */
+#define DRIVER_DISARMED LONG_MAX
+
+/**
+ * Timer driver's structure
+ **/
+typedef struct _MESA_timer_driver_inner_t{
+    MESA_timer_t *timer;            /* the driven timer */
+    pthread_mutex_t *lock;          /* held around timer, NULL if not shared */
+    long tick_nsec;                 /* nanoseconds of a tick */
+    long max_cb_times;              /* budget of each check */
+    long armed;                     /* deadline of timerfd in ticks, DRIVER_DISARMED if none */
+    int timer_fd;                   /* CLOCK_MONOTONIC timerfd */
+    int stop_fd;                    /* eventfd to stop MESA_timer_driver_run */
+}MESA_timer_driver_inner_t;
+
+
+
+/* Arm timerfd to the timer's next deadline, the caller holds lock */
+static int driver_arm(MESA_timer_driver_inner_t *_driver)
+{
+    struct itimerspec its = {{0, 0}, {0, 0}};
+    long next = MESA_timer_next_expire(_driver->timer);
+
+    if(next == -1)
+    {
+        if(_driver->armed == DRIVER_DISARMED)
+            return 0;
+        next = DRIVER_DISARMED;
+    }
+    else
+    {
+        /* a zero it_value disarms, a deadline passed fires at once */
+        long long nsec = (long long)next * _driver->tick_nsec;
+        if(nsec <= 0)
+            nsec = 1;
+        its.it_value.tv_sec = nsec / 1000000000;
+        its.it_value.tv_nsec = nsec % 1000000000;
+    }
+    if(timerfd_settime(_driver->timer_fd, TFD_TIMER_ABSTIME, &its, NULL) != 0)
+        return -1;
+    _driver->armed = next;
+    return 0;
+}
+
+
+
+MESA_timer_driver_t *MESA_timer_driver_create(MESA_timer_t *timer, long tick_nsec, long max_cb_times, pthread_mutex_t *lock)
+{
+    assert(timer != NULL);
+
+    MESA_timer_driver_inner_t *driver;
+
+    if(tick_nsec <= 0 || max_cb_times <= 0)
+    {
+        return (MESA_timer_driver_t *)NULL;
+    }
+    driver = (MESA_timer_driver_inner_t *)calloc(1, sizeof(MESA_timer_driver_inner_t));
+    driver->timer = timer;
+    driver->lock = lock;
+    driver->tick_nsec = tick_nsec;
+    driver->max_cb_times = max_cb_times;
+    driver->armed = DRIVER_DISARMED;
+    driver->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    driver->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(driver->timer_fd < 0 || driver->stop_fd < 0)
+    {
+        MESA_timer_driver_destroy((MESA_timer_driver_t *)driver);
+        return (MESA_timer_driver_t *)NULL;
+    }
+    return (MESA_timer_driver_t *)driver;
+}
+
+
+
+int MESA_timer_driver_fd(MESA_timer_driver_t *driver)
+{
+    assert(driver != NULL);
+    return ((MESA_timer_driver_inner_t *)driver)->timer_fd;
+}
+
+
+
+long MESA_timer_driver_now(MESA_timer_driver_t *driver)
+{
+    assert(driver != NULL);
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((long long)ts.tv_sec * 1000000000 + ts.tv_nsec) / ((MESA_timer_driver_inner_t *)driver)->tick_nsec;
+}
+
+
+
+long MESA_timer_driver_dispatch(MESA_timer_driver_t *driver)
+{
+    assert(driver != NULL);
+
+    MESA_timer_driver_inner_t *_driver = (MESA_timer_driver_inner_t *)driver;
+    uint64_t expirations;
+    long cb_cnt;
+
+    if(read(_driver->timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+    {
+        return -1;
+    }
+
+    if(_driver->lock != NULL)
+        pthread_mutex_lock(_driver->lock);
+    /* the timerfd fired, it is disarmed until armed again */
+    _driver->armed = DRIVER_DISARMED;
+    cb_cnt = MESA_timer_check(_driver->timer, MESA_timer_driver_now(driver), _driver->max_cb_times);
+    if(cb_cnt >= 0 && driver_arm(_driver) != 0)
+    {
+        cb_cnt = -1;
+    }
+    if(_driver->lock != NULL)
+        pthread_mutex_unlock(_driver->lock);
+    return cb_cnt;
+}
+
+
+
+int MESA_timer_driver_rearm(MESA_timer_driver_t *driver)
+{
+    assert(driver != NULL);
+
+    MESA_timer_driver_inner_t *_driver = (MESA_timer_driver_inner_t *)driver;
+    long next = MESA_timer_next_expire(_driver->timer);
+
+    if(next == -1 || next >= _driver->armed)
+    {
+        return 0;
+    }
+    return driver_arm(_driver);
+}
+
+
+
+int MESA_timer_driver_run(MESA_timer_driver_t *driver)
+{
+    assert(driver != NULL);
+
+    MESA_timer_driver_inner_t *_driver = (MESA_timer_driver_inner_t *)driver;
+    struct pollfd fds[2];
+    uint64_t cnt;
+
+    fds[0].fd = _driver->timer_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = _driver->stop_fd;
+    fds[1].events = POLLIN;
+
+    /* events may be added before running */
+    if(_driver->lock != NULL)
+        pthread_mutex_lock(_driver->lock);
+    _driver->armed = DRIVER_DISARMED;
+    if(driver_arm(_driver) != 0)
+    {
+        if(_driver->lock != NULL)
+            pthread_mutex_unlock(_driver->lock);
+        return -1;
+    }
+    if(_driver->lock != NULL)
+        pthread_mutex_unlock(_driver->lock);
+
+    while(1)
+    {
+        if(poll(fds, 2, -1) < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        if(fds[1].revents & POLLIN)
+        {
+            if(read(_driver->stop_fd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+                return -1;
+            return 0;
+        }
+        if((fds[0].revents & POLLIN) && MESA_timer_driver_dispatch(driver) < 0)
+        {
+            return -1;
+        }
+    }
+}
+
+
+
+void MESA_timer_driver_stop(MESA_timer_driver_t *driver)
+{
+    assert(driver != NULL);
+
+    uint64_t one = 1;
+    if(write(((MESA_timer_driver_inner_t *)driver)->stop_fd, &one, sizeof(one)) < 0)
+    {
+        /* the counter is already non-zero, run is stopping anyway */
+    }
+}
+
+
+
+void MESA_timer_driver_destroy(MESA_timer_driver_t *driver)
+{
+    assert(driver != NULL);
+
+    MESA_timer_driver_inner_t *_driver = (MESA_timer_driver_inner_t *)driver;
+    if(_driver->timer_fd >= 0)
+        close(_driver->timer_fd);
+    if(_driver->stop_fd >= 0)
+        close(_driver->stop_fd);
+    free(_driver);
+}
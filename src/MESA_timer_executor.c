@@ -0,0 +1,311 @@
+/************************************************
+*				MESA timer executor API
+* Checking threads unlink expired events by
+* MESA_timer_check_inflight and push them into a
+* bounded lock-free MPMC ring, worker threads pop
+* them, run callbacks and give them back by
+* MESA_timer_inflight_done.
+************************************************/
+#include "MESA_timer_executor.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+
+/* expired events unlinked at once */
+#define EXECUTOR_BATCH 64
+
+#define EXECUTOR_QUEUE_MIN 64
+
+#define CACHE_LINE 64
+
+typedef struct _executor_task_t{
+    MESA_timer_t *timer;                /* timer which handed the event out */
+    MESA_timer_inflight_t inflight;
+}executor_task_t;
+
+
+/**
+ * A cell of the ring. seq is the position the cell waits for: pos when it
+ * is free for the enqueue at pos, pos + 1 when it holds the task for the
+ * dequeue at pos.
+ **/
+typedef struct _executor_cell_t{
+    unsigned long seq;
+    executor_task_t task;
+}executor_cell_t;
+
+
+/**
+ * Executor's structure, head and tail are on their own cache lines
+ **/
+typedef struct _MESA_timer_executor_inner_t{
+    executor_cell_t *cells;
+    unsigned long mask;                 /* cells - 1, cells is a power of 2 */
+    int thread_cnt;
+    pthread_t *threads;
+    int stop;                           /* destroying, threads exit when the ring is empty */
+    sem_t ready;                        /* tasks pushed, threads sleep on it */
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle;                /* signaled when pending drops to 0 */
+    unsigned long head __attribute__((aligned(CACHE_LINE)));   /* next dequeue */
+    unsigned long tail __attribute__((aligned(CACHE_LINE)));   /* next enqueue */
+    long pending __attribute__((aligned(CACHE_LINE)));         /* tasks queued or running */
+}MESA_timer_executor_inner_t;
+
+
+
+/* Return -1 if the ring is full */
+static int executor_push(MESA_timer_executor_inner_t *_executor, const executor_task_t *task)
+{
+    unsigned long pos = __atomic_load_n(&(_executor->tail), __ATOMIC_RELAXED);
+    executor_cell_t *cell;
+    long diff;
+
+    while(1)
+    {
+        cell = &(_executor->cells[pos & _executor->mask]);
+        diff = (long)(__atomic_load_n(&(cell->seq), __ATOMIC_ACQUIRE) - pos);
+        if(diff == 0)
+        {
+            if(__atomic_compare_exchange_n(&(_executor->tail), &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if(diff < 0)
+        {
+            return -1;
+        }
+        else
+        {
+            pos = __atomic_load_n(&(_executor->tail), __ATOMIC_RELAXED);
+        }
+    }
+    cell->task = *task;
+    __atomic_store_n(&(cell->seq), pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+
+/* Return -1 if no task is ready, the ring is empty or a push is not finished */
+static int executor_pop(MESA_timer_executor_inner_t *_executor, executor_task_t *task)
+{
+    unsigned long pos = __atomic_load_n(&(_executor->head), __ATOMIC_RELAXED);
+    executor_cell_t *cell;
+    long diff;
+
+    while(1)
+    {
+        cell = &(_executor->cells[pos & _executor->mask]);
+        diff = (long)(__atomic_load_n(&(cell->seq), __ATOMIC_ACQUIRE) - (pos + 1));
+        if(diff == 0)
+        {
+            if(__atomic_compare_exchange_n(&(_executor->head), &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if(diff < 0)
+        {
+            return -1;
+        }
+        else
+        {
+            pos = __atomic_load_n(&(_executor->head), __ATOMIC_RELAXED);
+        }
+    }
+    *task = cell->task;
+    __atomic_store_n(&(cell->seq), pos + _executor->mask + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+
+static void executor_run(MESA_timer_executor_inner_t *_executor, const executor_task_t *task)
+{
+    task->inflight.timeout_cb(task->inflight.event);
+    if(task->inflight.free_cb != NULL)
+    {
+        task->inflight.free_cb(task->inflight.event);
+    }
+    MESA_timer_inflight_done(task->timer, task->inflight.index);
+
+    if(__atomic_sub_fetch(&(_executor->pending), 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        pthread_mutex_lock(&(_executor->idle_lock));
+        pthread_cond_broadcast(&(_executor->idle));
+        pthread_mutex_unlock(&(_executor->idle_lock));
+    }
+}
+
+
+static void *executor_thread(void *arg)
+{
+    MESA_timer_executor_inner_t *_executor = (MESA_timer_executor_inner_t *)arg;
+    executor_task_t task;
+
+    while(1)
+    {
+        while(sem_wait(&(_executor->ready)) != 0 && errno == EINTR)
+            ;
+
+        /* a post is made after its push, but an earlier push may still be
+         * going on, its task comes soon */
+        while(executor_pop(_executor, &task) != 0)
+        {
+            if(__atomic_load_n(&(_executor->stop), __ATOMIC_ACQUIRE)
+               && __atomic_load_n(&(_executor->head), __ATOMIC_RELAXED) == __atomic_load_n(&(_executor->tail), __ATOMIC_RELAXED))
+            {
+                return NULL;
+            }
+            sched_yield();
+        }
+        executor_run(_executor, &task);
+    }
+}
+
+
+
+MESA_timer_executor_t *MESA_timer_executor_create(int thread_cnt, long queue_size)
+{
+    MESA_timer_executor_inner_t *executor;
+    unsigned long cells = EXECUTOR_QUEUE_MIN, i;
+    void *mem = NULL;
+
+    if(thread_cnt <= 0 || queue_size <= 0)
+    {
+        return (MESA_timer_executor_t *)NULL;
+    }
+    while(cells < (unsigned long)queue_size)
+    {
+        cells *= 2;
+    }
+
+    if(posix_memalign(&mem, CACHE_LINE, sizeof(MESA_timer_executor_inner_t)) != 0)
+    {
+        return (MESA_timer_executor_t *)NULL;
+    }
+    executor = (MESA_timer_executor_inner_t *)mem;
+    executor->cells = (executor_cell_t *)malloc(sizeof(executor_cell_t) * cells);
+    executor->mask = cells - 1;
+    for(i = 0; i < cells; i++)
+    {
+        executor->cells[i].seq = i;
+    }
+    executor->head = 0;
+    executor->tail = 0;
+    executor->pending = 0;
+    executor->stop = 0;
+    sem_init(&(executor->ready), 0, 0);
+    pthread_mutex_init(&(executor->idle_lock), NULL);
+    pthread_cond_init(&(executor->idle), NULL);
+
+    executor->threads = (pthread_t *)malloc(sizeof(pthread_t) * thread_cnt);
+    for(executor->thread_cnt = 0; executor->thread_cnt < thread_cnt; executor->thread_cnt++)
+    {
+        if(pthread_create(&(executor->threads[executor->thread_cnt]), NULL, executor_thread, executor) != 0)
+        {
+            MESA_timer_executor_destroy((MESA_timer_executor_t *)executor);
+            return (MESA_timer_executor_t *)NULL;
+        }
+    }
+    return (MESA_timer_executor_t *)executor;
+}
+
+
+
+long MESA_timer_executor_check(MESA_timer_executor_t *executor, MESA_timer_t *timer, long current_time, long max_cnt)
+{
+    assert(executor != NULL && timer != NULL && max_cnt >= 0);
+
+    MESA_timer_executor_inner_t *_executor = (MESA_timer_executor_inner_t *)executor;
+    MESA_timer_inflight_t inflight[EXECUTOR_BATCH];
+    executor_task_t task;
+    long queued = 0, pushed, cnt, want, room, i;
+
+    task.timer = timer;
+    do
+    {
+        /* leave events due in timer rather than overrun the ring */
+        room = _executor->mask + 1 - (long)(__atomic_load_n(&(_executor->tail), __ATOMIC_RELAXED)
+                                           - __atomic_load_n(&(_executor->head), __ATOMIC_RELAXED));
+        want = max_cnt - queued;
+        if(want > room)
+            want = room;
+        if(want > EXECUTOR_BATCH)
+            want = EXECUTOR_BATCH;
+        if(want <= 0)
+            break;
+
+        cnt = MESA_timer_check_inflight(timer, current_time, inflight, want);
+        if(cnt < 0)
+            return -1;
+        __atomic_add_fetch(&(_executor->pending), cnt, __ATOMIC_RELAXED);
+        pushed = 0;
+        for(i = 0; i < cnt; i++)
+        {
+            task.inflight = inflight[i];
+            /* other checking threads took the room, run it here */
+            if(executor_push(_executor, &task) != 0)
+            {
+                executor_run(_executor, &task);
+                continue;
+            }
+            sem_post(&(_executor->ready));
+            pushed ++;
+        }
+        queued += cnt;
+        /* a short batch, or one partly run here because the ring is full,
+         * ends the check like a full ring does */
+    }while(pushed == want);
+    return queued;
+}
+
+
+
+long MESA_timer_executor_pending(MESA_timer_executor_t *executor)
+{
+    assert(executor != NULL);
+    return __atomic_load_n(&(((MESA_timer_executor_inner_t *)executor)->pending), __ATOMIC_ACQUIRE);
+}
+
+
+
+void MESA_timer_executor_wait(MESA_timer_executor_t *executor)
+{
+    assert(executor != NULL);
+
+    MESA_timer_executor_inner_t *_executor = (MESA_timer_executor_inner_t *)executor;
+    pthread_mutex_lock(&(_executor->idle_lock));
+    while(__atomic_load_n(&(_executor->pending), __ATOMIC_ACQUIRE) > 0)
+    {
+        pthread_cond_wait(&(_executor->idle), &(_executor->idle_lock));
+    }
+    pthread_mutex_unlock(&(_executor->idle_lock));
+}
+
+
+
+void MESA_timer_executor_destroy(MESA_timer_executor_t *executor)
+{
+    assert(executor != NULL);
+
+    MESA_timer_executor_inner_t *_executor = (MESA_timer_executor_inner_t *)executor;
+    int i;
+
+    /* one more post per thread, each thread exits on one when the ring is empty */
+    __atomic_store_n(&(_executor->stop), 1, __ATOMIC_RELEASE);
+    for(i = 0; i < _executor->thread_cnt; i++)
+    {
+        sem_post(&(_executor->ready));
+    }
+    for(i = 0; i < _executor->thread_cnt; i++)
+    {
+        pthread_join(_executor->threads[i], NULL);
+    }
+    sem_destroy(&(_executor->ready));
+    pthread_mutex_destroy(&(_executor->idle_lock));
+    pthread_cond_destroy(&(_executor->idle));
+    free(_executor->threads);
+    free(_executor->cells);
+    free(_executor);
+}
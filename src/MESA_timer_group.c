@@ -0,0 +1,312 @@
+/************************************************
+*				MESA timer group API
+* One MESA timer per worker. Expired events are handed
+* out by MESA_timer_check_collect into a locked backlog
+* per shard, which idle workers steal batches from.
+************************************************/
+#include "MESA_timer_group.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+/* expired events moved or processed under one lock */
+#define GROUP_BATCH 64
+
+/* a backlog shorter than this is left to its owner */
+#define GROUP_STEAL_MIN (GROUP_BATCH * 2)
+
+#define GROUP_BACKLOG_INIT 256
+
+#define CACHE_LINE 64
+
+/**
+ * A shard: the timer is touched by its owner only, the backlog by
+ * anyone holding lock. Shards are cache line aligned so that owners
+ * never share a line.
+ **/
+typedef struct _timer_shard_t{
+    MESA_timer_t *timer;                /* owned by one worker */
+    pthread_mutex_t lock;               /* protects backlog */
+    MESA_timer_expired_t *backlog;      /* ring of expired events */
+    long capacity;                      /* size of backlog, a power of 2 */
+    long head;                          /* next event to process */
+    long tail;                          /* next free record */
+    long backlog_cnt;                   /* tail - head, read without lock */
+}__attribute__((aligned(CACHE_LINE))) timer_shard_t;
+
+
+/**
+ * Timer group's structure
+ **/
+typedef struct _MESA_timer_group_inner_t{
+    int shard_cnt;
+    timer_shard_t *shards;
+}MESA_timer_group_inner_t;
+
+
+/* shard of the worker running MESA_timer_group_check */
+static __thread int group_self = -1;
+
+
+
+/* Append cnt events to shard's backlog, the caller holds shard's lock */
+static void shard_push(timer_shard_t *shard, const MESA_timer_expired_t *events, long cnt)
+{
+    long i;
+
+    if(shard->tail - shard->head + cnt > shard->capacity)
+    {
+        long capacity = shard->capacity;
+        MESA_timer_expired_t *backlog;
+
+        while(shard->tail - shard->head + cnt > capacity)
+        {
+            capacity *= 2;
+        }
+        backlog = (MESA_timer_expired_t *)malloc(sizeof(MESA_timer_expired_t) * capacity);
+        for(i = shard->head; i < shard->tail; i++)
+        {
+            backlog[i & (capacity - 1)] = shard->backlog[i & (shard->capacity - 1)];
+        }
+        free(shard->backlog);
+        shard->backlog = backlog;
+        shard->capacity = capacity;
+    }
+    for(i = 0; i < cnt; i++)
+    {
+        shard->backlog[(shard->tail + i) & (shard->capacity - 1)] = events[i];
+    }
+    shard->tail += cnt;
+    __atomic_store_n(&(shard->backlog_cnt), shard->tail - shard->head, __ATOMIC_RELAXED);
+}
+
+
+/* Take at most max_cnt events from shard's backlog, the caller holds shard's lock */
+static long shard_pop(timer_shard_t *shard, MESA_timer_expired_t *events, long max_cnt)
+{
+    long cnt = shard->tail - shard->head, i;
+
+    if(cnt > max_cnt)
+    {
+        cnt = max_cnt;
+    }
+    for(i = 0; i < cnt; i++)
+    {
+        events[i] = shard->backlog[(shard->head + i) & (shard->capacity - 1)];
+    }
+    shard->head += cnt;
+    __atomic_store_n(&(shard->backlog_cnt), shard->tail - shard->head, __ATOMIC_RELAXED);
+    return cnt;
+}
+
+
+static long run_callbacks(const MESA_timer_expired_t *events, long cnt)
+{
+    long i;
+
+    for(i = 0; i < cnt; i++)
+    {
+        events[i].timeout_cb(events[i].event);
+        if(events[i].free_cb != NULL)
+        {
+            events[i].free_cb(events[i].event);
+        }
+    }
+    return cnt;
+}
+
+
+/* Shard with the longest backlog except self, -1 if none is worth stealing */
+static int find_victim(MESA_timer_group_inner_t *_group, int self)
+{
+    long max_cnt = GROUP_STEAL_MIN - 1, cnt;
+    int victim = -1, i;
+
+    for(i = 0; i < _group->shard_cnt; i++)
+    {
+        if(i == self)
+            continue;
+        cnt = __atomic_load_n(&(_group->shards[i].backlog_cnt), __ATOMIC_RELAXED);
+        if(cnt > max_cnt)
+        {
+            max_cnt = cnt;
+            victim = i;
+        }
+    }
+    return victim;
+}
+
+
+/**
+ * Lock a shard worth stealing from: the most loaded one, or when its lock is
+ * held the others after it in turn. -1 after one pass finds none, so that an
+ * idle worker does not spin on a busy lock.
+ **/
+static int lock_victim(MESA_timer_group_inner_t *_group, int self)
+{
+    int victim = find_victim(_group, self), i, k;
+
+    if(victim == -1)
+        return -1;
+    for(k = 0; k < _group->shard_cnt; k++)
+    {
+        i = (victim + k) % _group->shard_cnt;
+        if(i == self || (k > 0 && __atomic_load_n(&(_group->shards[i].backlog_cnt), __ATOMIC_RELAXED) < GROUP_STEAL_MIN))
+            continue;
+        if(pthread_mutex_trylock(&(_group->shards[i].lock)) == 0)
+            return i;
+    }
+    return -1;
+}
+
+
+
+MESA_timer_group_t *MESA_timer_group_create(int shard_cnt, const MESA_timer_opt_t *opt)
+{
+    assert(opt != NULL);
+
+    MESA_timer_group_inner_t *group;
+    void *shards = NULL;
+    int i;
+
+    if(shard_cnt <= 0)
+    {
+        return (MESA_timer_group_t *)NULL;
+    }
+    if(posix_memalign(&shards, CACHE_LINE, sizeof(timer_shard_t) * shard_cnt) != 0)
+    {
+        return (MESA_timer_group_t *)NULL;
+    }
+    memset(shards, 0, sizeof(timer_shard_t) * shard_cnt);
+
+    group = (MESA_timer_group_inner_t *)calloc(1, sizeof(MESA_timer_group_inner_t));
+    group->shard_cnt = shard_cnt;
+    group->shards = (timer_shard_t *)shards;
+    for(i = 0; i < shard_cnt; i++)
+    {
+        timer_shard_t *shard = &(group->shards[i]);
+        shard->timer = MESA_timer_create_ex(opt);
+        if(shard->timer == NULL)
+        {
+            group->shard_cnt = i;
+            MESA_timer_group_destroy((MESA_timer_group_t *)group);
+            return (MESA_timer_group_t *)NULL;
+        }
+        pthread_mutex_init(&(shard->lock), NULL);
+        shard->capacity = GROUP_BACKLOG_INIT;
+        shard->backlog = (MESA_timer_expired_t *)malloc(sizeof(MESA_timer_expired_t) * shard->capacity);
+    }
+    return (MESA_timer_group_t *)group;
+}
+
+
+
+MESA_timer_t *MESA_timer_group_shard(MESA_timer_group_t *group, int shard)
+{
+    assert(group != NULL);
+
+    MESA_timer_group_inner_t *_group = (MESA_timer_group_inner_t *)group;
+    assert(shard >= 0 && shard < _group->shard_cnt);
+    return _group->shards[shard].timer;
+}
+
+
+
+long MESA_timer_group_check(MESA_timer_group_t *group, int shard, long current_time, long max_cb_times)
+{
+    assert(group != NULL && current_time >= 0 && max_cb_times >= 0);
+
+    MESA_timer_group_inner_t *_group = (MESA_timer_group_inner_t *)group;
+    assert(shard >= 0 && shard < _group->shard_cnt);
+
+    timer_shard_t *self = &(_group->shards[shard]);
+    MESA_timer_expired_t events[GROUP_BATCH];
+    long cb_cnt = 0, cnt;
+    int prev_self = group_self, victim;
+
+    /* move all expired events to the backlog, where others can see them */
+    do
+    {
+        cnt = MESA_timer_check_collect(self->timer, current_time, events, GROUP_BATCH);
+        if(cnt < 0)
+            return -1;
+        if(cnt > 0)
+        {
+            pthread_mutex_lock(&(self->lock));
+            shard_push(self, events, cnt);
+            pthread_mutex_unlock(&(self->lock));
+        }
+    }while(cnt == GROUP_BATCH);
+
+    group_self = shard;
+
+    /* own backlog first */
+    while(cb_cnt < max_cb_times && __atomic_load_n(&(self->backlog_cnt), __ATOMIC_RELAXED) > 0)
+    {
+        pthread_mutex_lock(&(self->lock));
+        cnt = shard_pop(self, events, max_cb_times - cb_cnt < GROUP_BATCH ? max_cb_times - cb_cnt : GROUP_BATCH);
+        pthread_mutex_unlock(&(self->lock));
+        cb_cnt += run_callbacks(events, cnt);
+    }
+
+    /* then help the most loaded shard, one batch per lock */
+    while(cb_cnt < max_cb_times && (victim = lock_victim(_group, shard)) != -1)
+    {
+        timer_shard_t *other = &(_group->shards[victim]);
+        cnt = shard_pop(other, events, max_cb_times - cb_cnt < GROUP_BATCH ? max_cb_times - cb_cnt : GROUP_BATCH);
+        pthread_mutex_unlock(&(other->lock));
+        cb_cnt += run_callbacks(events, cnt);
+    }
+
+    group_self = prev_self;
+    return cb_cnt;
+}
+
+
+
+int MESA_timer_group_self(void)
+{
+    return group_self;
+}
+
+
+
+long MESA_timer_group_backlog(MESA_timer_group_t *group, int shard)
+{
+    assert(group != NULL);
+
+    MESA_timer_group_inner_t *_group = (MESA_timer_group_inner_t *)group;
+    assert(shard >= 0 && shard < _group->shard_cnt);
+    return __atomic_load_n(&(_group->shards[shard].backlog_cnt), __ATOMIC_RELAXED);
+}
+
+
+
+void MESA_timer_group_destroy(MESA_timer_group_t *group)
+{
+    assert(group != NULL);
+
+    MESA_timer_group_inner_t *_group = (MESA_timer_group_inner_t *)group;
+    int i;
+    long j;
+
+    for(i = 0; i < _group->shard_cnt; i++)
+    {
+        timer_shard_t *shard = &(_group->shards[i]);
+        for(j = shard->head; j < shard->tail; j++)
+        {
+            MESA_timer_expired_t *event = &(shard->backlog[j & (shard->capacity - 1)]);
+            if(event->free_cb != NULL)
+            {
+                event->free_cb(event->event);
+            }
+        }
+        free(shard->backlog);
+        pthread_mutex_destroy(&(shard->lock));
+        MESA_timer_destroy(shard->timer);
+    }
+    free(_group->shards);
+    free(_group);
+}
@@ -0,0 +1,160 @@
+/************************************************
+*				MESA timer trace API
+* Records are appended to a memory buffer, which
+* is written to the ring of the trace file when
+* full, so that a recorded call costs a copy.
+************************************************/
+#include "MESA_timer_trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* records buffered before a write, 128KB */
+#define TRACE_BUF_RECORDS 4096
+
+typedef struct _MESA_timer_trace_inner_t{
+    int fd;
+    int error;                          /* a write has failed */
+    MESA_timer_trace_header_t header;   /* header.written counts records in the file */
+    long buf_cnt;                       /* records in buf */
+    MESA_timer_trace_record_t buf[TRACE_BUF_RECORDS];
+}MESA_timer_trace_inner_t;
+
+
+
+static int trace_pwrite(int fd, const void *data, size_t len, off_t offset)
+{
+    const char *p = (const char *)data;
+    ssize_t n;
+
+    while(len > 0)
+    {
+        n = pwrite(fd, p, len, offset);
+        if(n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+
+/* Write buffered records to the ring, wrapping at its end */
+static void trace_write_buf(MESA_timer_trace_inner_t *_trace)
+{
+    MESA_timer_trace_header_t *header = &(_trace->header);
+    long done = 0, pos, cnt;
+
+    while(done < _trace->buf_cnt)
+    {
+        pos = header->written % header->ring_records;
+        cnt = _trace->buf_cnt - done;
+        if(cnt > (long)header->ring_records - pos)
+        {
+            cnt = header->ring_records - pos;
+        }
+        if(trace_pwrite(_trace->fd, &(_trace->buf[done]), sizeof(MESA_timer_trace_record_t) * cnt,
+                        sizeof(MESA_timer_trace_header_t) + sizeof(MESA_timer_trace_record_t) * pos) != 0)
+        {
+            _trace->error = 1;
+        }
+        header->written += cnt;
+        done += cnt;
+    }
+    _trace->buf_cnt = 0;
+}
+
+
+
+MESA_timer_trace_t *MESA_timer_trace_open(const char *path, long ring_records)
+{
+    MESA_timer_trace_inner_t *trace;
+
+    if(path == NULL || ring_records <= 0)
+    {
+        return (MESA_timer_trace_t *)NULL;
+    }
+    trace = (MESA_timer_trace_inner_t *)calloc(1, sizeof(MESA_timer_trace_inner_t));
+    if(trace == NULL)
+    {
+        return (MESA_timer_trace_t *)NULL;
+    }
+    trace->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(trace->fd < 0)
+    {
+        free(trace);
+        return (MESA_timer_trace_t *)NULL;
+    }
+    trace->header.magic = MESA_TIMER_TRACE_MAGIC;
+    trace->header.version = MESA_TIMER_TRACE_VERSION;
+    trace->header.record_size = sizeof(MESA_timer_trace_record_t);
+    trace->header.ring_records = ring_records;
+    trace->header.timer_type = -1;
+    if(trace_pwrite(trace->fd, &(trace->header), sizeof(trace->header), 0) != 0)
+    {
+        close(trace->fd);
+        free(trace);
+        return (MESA_timer_trace_t *)NULL;
+    }
+    return (MESA_timer_trace_t *)trace;
+}
+
+
+
+void MESA_timer_trace_write(MESA_timer_trace_t *trace, const MESA_timer_trace_record_t *record)
+{
+    assert(trace != NULL && record != NULL);
+
+    MESA_timer_trace_inner_t *_trace = (MESA_timer_trace_inner_t *)trace;
+
+    /* the ring may overwrite it, the header keeps it */
+    if(record->op == MESA_TIMER_TRACE_START)
+    {
+        _trace->header.timer_type = record->arg;
+        _trace->header.wheel_size = record->arg2;
+        _trace->header.slack_pct = record->id;
+        _trace->header.lazy_reset = (record->flags & MESA_TIMER_TRACE_START_LAZY_RESET) != 0;
+    }
+    _trace->buf[_trace->buf_cnt++] = *record;
+    if(_trace->buf_cnt == TRACE_BUF_RECORDS)
+    {
+        trace_write_buf(_trace);
+    }
+}
+
+
+
+int MESA_timer_trace_flush(MESA_timer_trace_t *trace)
+{
+    assert(trace != NULL);
+
+    MESA_timer_trace_inner_t *_trace = (MESA_timer_trace_inner_t *)trace;
+
+    trace_write_buf(_trace);
+    if(trace_pwrite(_trace->fd, &(_trace->header), sizeof(_trace->header), 0) != 0)
+    {
+        _trace->error = 1;
+    }
+    return _trace->error ? -1 : 0;
+}
+
+
+
+int MESA_timer_trace_close(MESA_timer_trace_t *trace)
+{
+    assert(trace != NULL);
+
+    MESA_timer_trace_inner_t *_trace = (MESA_timer_trace_inner_t *)trace;
+    int ret = MESA_timer_trace_flush(trace);
+
+    if(close(_trace->fd) != 0)
+    {
+        ret = -1;
+    }
+    free(_trace);
+    return ret;
+}
@@ -0,0 +1,373 @@
+/************************************************
+*				MESA timer trace replay
+* Replay a trace recorded by MESA_timer_set_trace
+* against a timer of any type and wheel size, and
+* report throughput and latency of each call.
+* Usage: mesa_timer_replay [-t type] [-w wheel_size]
+*                          [-q] trace_file
+************************************************/
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+#include<unistd.h>
+#include"MESA_timer.h"
+#include"MESA_timer_trace.h"
+
+#define OP_CNT (MESA_TIMER_TRACE_CHECK + 1)
+
+/* events handed out by one MESA_timer_check_collect or _inflight at most */
+#define REPLAY_BATCH 4096
+
+static const char *op_names[OP_CNT] = {"start", "add", "periodic", "del", "reset", "check"};
+
+/**
+ * Element of a recorded id. The event of an add is its id and gen, so that
+ * a callback of an element whose id was already reused leaves the slot alone.
+ **/
+typedef struct _replay_slot_t{
+    MESA_timer_index_t *index;          /* NULL when the element is gone */
+    unsigned int gen;
+    int periodic;
+}replay_slot_t;
+
+typedef struct _replay_t{
+    MESA_timer_t *timer;
+    replay_slot_t *slots;
+    long fired;
+    long failed;                        /* adds and resets the timer refused */
+    MESA_timer_expired_t *expired;
+    MESA_timer_inflight_t *inflight;
+}replay_t;
+
+static replay_t *R;
+
+static long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static void event_cb(void *event)
+{
+    unsigned long e = (unsigned long)event;
+    replay_slot_t *slot = &(R->slots[e & 0xffffffffUL]);
+
+    R->fired ++;
+    if(slot->gen == (e >> 32) && !slot->periodic)
+    {
+        slot->index = NULL;
+    }
+}
+
+/* Load records of the ring, oldest first, and the recorded timer's options into opt */
+static MESA_timer_trace_record_t *load_trace(const char *path, long *cnt, MESA_timer_opt_t *opt)
+{
+    MESA_timer_trace_header_t header;
+    MESA_timer_trace_record_t *records;
+    long start, first;
+    FILE *fp = fopen(path, "rb");
+
+    if(fp == NULL)
+    {
+        perror(path);
+        return NULL;
+    }
+    if(fread(&header, sizeof(header), 1, fp) != 1 || header.magic != MESA_TIMER_TRACE_MAGIC
+       || header.version != MESA_TIMER_TRACE_VERSION || header.record_size != sizeof(MESA_timer_trace_record_t))
+    {
+        fprintf(stderr, "%s: not a trace of version %d\n", path, MESA_TIMER_TRACE_VERSION);
+        fclose(fp);
+        return NULL;
+    }
+    if(header.timer_type != -1)
+    {
+        opt->type = header.timer_type;
+        opt->wheel_size = header.wheel_size;
+        opt->slack_pct = header.slack_pct;
+        opt->lazy_reset = header.lazy_reset;
+    }
+    *cnt = header.written < header.ring_records ? header.written : header.ring_records;
+    start = header.written > header.ring_records ? header.written % header.ring_records : 0;
+    records = (MESA_timer_trace_record_t *)malloc(sizeof(MESA_timer_trace_record_t) * (*cnt + 1));
+
+    /* the ring from start to its end, then from its beginning */
+    first = *cnt - start;
+    if(fseek(fp, sizeof(header) + sizeof(MESA_timer_trace_record_t) * start, SEEK_SET) != 0
+       || fread(records, sizeof(MESA_timer_trace_record_t), first, fp) != (size_t)first
+       || fseek(fp, sizeof(header), SEEK_SET) != 0
+       || fread(records + first, sizeof(MESA_timer_trace_record_t), start, fp) != (size_t)start)
+    {
+        fprintf(stderr, "%s: truncated\n", path);
+        free(records);
+        fclose(fp);
+        return NULL;
+    }
+    fclose(fp);
+    return records;
+}
+
+static void replay_add(replay_t *r, const MESA_timer_trace_record_t *rec)
+{
+    replay_slot_t *slot = &(r->slots[rec->id]);
+    void *event;
+    int ret;
+
+    slot->gen ++;
+    slot->periodic = (rec->op == MESA_TIMER_TRACE_ADD_PERIODIC);
+    event = (void *)(((unsigned long)slot->gen << 32) | rec->id);
+    if(slot->periodic)
+        ret = MESA_timer_add_periodic(r->timer, rec->time, rec->arg, rec->arg2, rec->flags, event_cb, event, NULL, &(slot->index));
+    else if(rec->arg2 == -1)
+        ret = MESA_timer_add(r->timer, rec->time, rec->arg, event_cb, event, NULL, &(slot->index));
+    else
+        ret = MESA_timer_add_slack(r->timer, rec->time, rec->arg, rec->arg2, event_cb, event, NULL, &(slot->index));
+    if(ret != 0)
+    {
+        r->failed ++;
+    }
+}
+
+static void replay_check(replay_t *r, const MESA_timer_trace_record_t *rec)
+{
+    long left = rec->arg, want, cnt, i;
+
+    if(rec->flags == MESA_TIMER_TRACE_CHECK_CB)
+    {
+        MESA_timer_check(r->timer, rec->time, rec->arg);
+        return;
+    }
+    do
+    {
+        want = left < REPLAY_BATCH ? left : REPLAY_BATCH;
+        if(rec->flags == MESA_TIMER_TRACE_CHECK_COLLECT)
+        {
+            cnt = MESA_timer_check_collect(r->timer, rec->time, r->expired, want);
+            for(i = 0; i < cnt; i++)
+            {
+                r->expired[i].timeout_cb(r->expired[i].event);
+            }
+        }
+        else
+        {
+            cnt = MESA_timer_check_inflight(r->timer, rec->time, r->inflight, want);
+            for(i = 0; i < cnt; i++)
+            {
+                r->inflight[i].timeout_cb(r->inflight[i].event);
+                MESA_timer_inflight_done(r->timer, r->inflight[i].index);
+            }
+        }
+        left -= want;
+    }while(cnt == want && left > 0);
+}
+
+static void replay_one(replay_t *r, const MESA_timer_trace_record_t *rec)
+{
+    replay_slot_t *slot;
+
+    /* id of a start is not an element */
+    if(rec->op == MESA_TIMER_TRACE_START)
+        return;
+    slot = &(r->slots[rec->id]);
+    switch(rec->op)
+    {
+        case MESA_TIMER_TRACE_ADD:
+        case MESA_TIMER_TRACE_ADD_PERIODIC:
+            replay_add(r, rec);
+            break;
+        case MESA_TIMER_TRACE_DEL:
+            if(slot->index != NULL)
+            {
+                MESA_timer_del(r->timer, slot->index);
+                slot->index = NULL;
+            }
+            break;
+        case MESA_TIMER_TRACE_RESET:
+            /* the element timed out here but was still in the recorded timer,
+             * or was reset by its own callback there */
+            if(slot->index == NULL)
+            {
+                replay_add(r, rec);
+                break;
+            }
+            if(rec->arg2 == -1)
+                MESA_timer_reset(r->timer, slot->index, rec->time, rec->arg);
+            else
+                MESA_timer_reset_slack(r->timer, slot->index, rec->time, rec->arg, rec->arg2);
+            break;
+        case MESA_TIMER_TRACE_CHECK:
+            replay_check(r, rec);
+            break;
+        default:
+            break;
+    }
+}
+
+static int cmp_long(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Replay cnt records on a new timer created by opt, and store the duration of each call in
+ * lat if it is not NULL. Return the nanoseconds of the whole replay.
+ **/
+static long replay(const MESA_timer_trace_record_t *records, long cnt, long max_id,
+                   const MESA_timer_opt_t *opt, long *lat, replay_t *r)
+{
+    long i, t0, t1, start;
+
+    memset(r, 0, sizeof(*r));
+    r->timer = MESA_timer_create_ex(opt);
+    if(r->timer == NULL)
+    {
+        return -1;
+    }
+    r->slots = (replay_slot_t *)calloc(max_id + 1, sizeof(replay_slot_t));
+    r->expired = (MESA_timer_expired_t *)malloc(sizeof(MESA_timer_expired_t) * REPLAY_BATCH);
+    r->inflight = (MESA_timer_inflight_t *)malloc(sizeof(MESA_timer_inflight_t) * REPLAY_BATCH);
+    R = r;
+
+    start = now_ns();
+    if(lat == NULL)
+    {
+        for(i = 0; i < cnt; i++)
+        {
+            replay_one(r, &records[i]);
+        }
+    }
+    else
+    {
+        for(i = 0; i < cnt; i++)
+        {
+            t0 = now_ns();
+            replay_one(r, &records[i]);
+            t1 = now_ns();
+            lat[i] = t1 - t0;
+        }
+    }
+    start = now_ns() - start;
+
+    MESA_timer_destroy(r->timer);
+    free(r->slots);
+    free(r->expired);
+    free(r->inflight);
+    return start;
+}
+
+static void report_latency(const MESA_timer_trace_record_t *records, long cnt, long *lat)
+{
+    long *sorted = (long *)malloc(sizeof(long) * (cnt + 1));
+    long n, i, sum;
+    int op;
+
+    printf("%-9s %10s %10s %10s %10s %10s %12s\n", "call", "count", "mean-ns", "p50-ns", "p99-ns", "p99.9-ns", "max-ns");
+    for(op = MESA_TIMER_TRACE_ADD; op < OP_CNT; op++)
+    {
+        for(n = 0, sum = 0, i = 0; i < cnt; i++)
+        {
+            if(records[i].op == op)
+            {
+                sorted[n++] = lat[i];
+                sum += lat[i];
+            }
+        }
+        if(n == 0)
+            continue;
+        qsort(sorted, n, sizeof(long), cmp_long);
+        printf("%-9s %10ld %10ld %10ld %10ld %10ld %12ld\n", op_names[op], n, sum / n,
+               sorted[n / 2], sorted[n * 99 / 100], sorted[n * 999 / 1000], sorted[n - 1]);
+    }
+    free(sorted);
+}
+
+int main(int argc, char *argv[])
+{
+    MESA_timer_trace_record_t *records;
+    replay_t r;
+    MESA_timer_opt_t rec_opt, timer_opt;
+    long cnt, i, max_id = 0, wheel_size = -1, ns, *lat;
+    long ops[OP_CNT] = {0};
+    int opt, type = -1, quiet = 0;
+
+    while((opt = getopt(argc, argv, "t:w:q")) != -1)
+    {
+        switch(opt)
+        {
+            case 't':
+                type = atoi(optarg);
+                break;
+            case 'w':
+                wheel_size = atol(optarg);
+                break;
+            case 'q':
+                quiet = 1;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-t type] [-w wheel_size] [-q] trace_file\n", argv[0]);
+                return 1;
+        }
+    }
+    if(optind != argc - 1)
+    {
+        fprintf(stderr, "usage: %s [-t type] [-w wheel_size] [-q] trace_file\n", argv[0]);
+        return 1;
+    }
+    MESA_timer_opt_init(&rec_opt);
+    rec_opt.type = TM_TYPE_WHEEL;
+    records = load_trace(argv[optind], &cnt, &rec_opt);
+    if(records == NULL)
+    {
+        return 1;
+    }
+
+    for(i = 0; i < cnt; i++)
+    {
+        if(records[i].op >= OP_CNT)
+        {
+            fprintf(stderr, "record %ld: unknown call %d\n", i, records[i].op);
+            return 1;
+        }
+        if(records[i].op != MESA_TIMER_TRACE_START && records[i].id > max_id)
+            max_id = records[i].id;
+        ops[records[i].op] ++;
+    }
+    /* the recorded timer's configuration is the default */
+    timer_opt = rec_opt;
+    if(type != -1)
+        timer_opt.type = type;
+    if(wheel_size != -1)
+        timer_opt.wheel_size = wheel_size;
+    else if(timer_opt.type != rec_opt.type)
+        timer_opt.wheel_size = 0;
+    if(timer_opt.wheel_size == 0 && (timer_opt.type == TM_TYPE_WHEEL || timer_opt.type == TM_TYPE_SWHEEL))
+        timer_opt.wheel_size = 1000;
+
+    printf("%ld records: %ld add, %ld periodic, %ld del, %ld reset, %ld check\n", cnt,
+           ops[MESA_TIMER_TRACE_ADD], ops[MESA_TIMER_TRACE_ADD_PERIODIC], ops[MESA_TIMER_TRACE_DEL],
+           ops[MESA_TIMER_TRACE_RESET], ops[MESA_TIMER_TRACE_CHECK]);
+    printf("type %d wheel_size %ld slack_pct %d lazy_reset %d\n", timer_opt.type, timer_opt.wheel_size,
+           timer_opt.slack_pct, timer_opt.lazy_reset);
+
+    ns = replay(records, cnt, max_id, &timer_opt, NULL, &r);
+    if(ns < 0)
+    {
+        fprintf(stderr, "cannot create a timer of type %d wheel_size %ld\n", timer_opt.type, timer_opt.wheel_size);
+        return 1;
+    }
+    printf("%.3f s, %.1f ns per call, %.0f calls/s, %ld callbacks, %ld refused\n", ns / 1e9,
+           cnt ? (double)ns / cnt : 0, ns ? cnt * 1e9 / ns : 0, r.fired, r.failed);
+
+    /* reading the clock around every call slows the replay, so latency has its own pass */
+    if(!quiet && cnt > 0)
+    {
+        lat = (long *)malloc(sizeof(long) * cnt);
+        replay(records, cnt, max_id, &timer_opt, lat, &r);
+        report_latency(records, cnt, lat);
+        free(lat);
+    }
+    free(records);
+    return 0;
+}